@@ -0,0 +1,136 @@
+#!/usr/bin/env python
+# Benchmarks the overhead of the jail on hooked calls. For each
+# configuration, build/bench_jail times a loop of one call (see
+# src/bench_jail.c), both without the jail and with it under whitelists of
+# various sizes, in text and precompiled form, for paths of various depths
+# given absolute or relative to the working directory.
+#
+# Results are written as one JSON object per line, e.g.:
+#
+#   {"op": "open", "jail": true, "whitelist_size": 1000,
+#    "whitelist_format": "index", "depth": 8, "relative": false,
+#    "iterations": 200000, "ns_per_call": 812.3, "calls_per_sec": 1231072, ...}
+
+from __future__ import print_function
+
+import os
+import sys
+import json
+import shutil
+import argparse
+import tempfile
+import subprocess
+from os.path import join as pjoin
+
+ROOT = os.path.dirname(os.path.realpath(__file__))
+JAIL_SO = pjoin(ROOT, 'build', 'libhdistjail.so.1')
+BENCH = pjoin(ROOT, 'build', 'bench_jail')
+WHITELIST_TOOL = pjoin(ROOT, 'build', 'hdistjail-whitelist')
+
+OPS = ['open', 'stat', 'access', 'fopen', 'execve']
+SIZES = [10, 1000, 100000, 1000000]
+DEPTHS = [1, 8, 32]
+ITERATIONS = {'open': 200000, 'stat': 200000, 'access': 200000,
+              'fopen': 100000, 'execve': 200}
+
+
+def make_tree(tempdir, depth):
+    """creates tree/d0/.../d<depth-1>/file, where file is a symlink to the
+    benchmark program (so that it can also be exec-ed); returns the path
+    relative to tree"""
+    rel = '/'.join('d%d' % i for i in range(depth)) + '/file'
+    p = pjoin(tempdir, 'tree', rel)
+    if not os.path.exists(p):
+        os.makedirs(os.path.dirname(p))
+        os.symlink(BENCH, p)
+    return rel
+
+
+def make_whitelist(tempdir, size, paths):
+    """writes a whitelist with `size` entries, including `paths` and their
+    parent directories, and its precompiled index; returns both filenames"""
+    filename = pjoin(tempdir, 'whitelist-%d.txt' % size)
+    entries = set()
+    for p in paths:
+        while p != '/':
+            entries.add(p)
+            p = os.path.dirname(p)
+    with open(filename, 'w') as f:
+        for p in sorted(entries):
+            f.write(p + '\n')
+        # filler in a realistic mix of exact entries and prefixes
+        for i in range(size - len(entries)):
+            if i % 10 == 0:
+                f.write('/usr/lib/pkg%d/**\n' % i)
+            else:
+                f.write('/usr/share/pkg%d/dir%d/file%d.h\n' % (i // 100, i // 10 % 10, i))
+    subprocess.check_call([WHITELIST_TOOL, filename, filename + '.idx'])
+    return filename, filename + '.idx'
+
+
+def run(op, path, iterations, cwd, env):
+    out = subprocess.check_output([BENCH, op, path, str(iterations)], cwd=cwd, env=env)
+    return json.loads(out.decode())
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark the jail overhead')
+    parser.add_argument('--ops', default=','.join(OPS),
+                        help='comma-separated list of ops (default: %(default)s)')
+    parser.add_argument('--sizes', default=','.join(str(x) for x in SIZES),
+                        help='comma-separated whitelist sizes (default: %(default)s)')
+    parser.add_argument('--depths', default=','.join(str(x) for x in DEPTHS),
+                        help='comma-separated path depths (default: %(default)s)')
+    parser.add_argument('--scale', type=float, default=1.0,
+                        help='scale the number of iterations')
+    parser.add_argument('-o', '--output', help='write results to this file')
+    args = parser.parse_args()
+    ops = args.ops.split(',')
+    sizes = [int(x) for x in args.sizes.split(',')]
+    depths = [int(x) for x in args.depths.split(',')]
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    tempdir = tempfile.mkdtemp(prefix='jailbench-')
+    try:
+        tree = pjoin(tempdir, 'tree')
+        rel_paths = dict((depth, make_tree(tempdir, depth)) for depth in depths)
+        abs_paths = [pjoin(tree, p) for p in rel_paths.values()]
+
+        configs = [dict(jail=False, whitelist_size=None, whitelist_format=None)]
+        whitelists = {}
+        for size in sizes:
+            whitelists[size] = make_whitelist(tempdir, size, abs_paths)
+            for fmt in ['text', 'index']:
+                configs.append(dict(jail=True, whitelist_size=size, whitelist_format=fmt))
+
+        for config in configs:
+            env = dict(os.environ)
+            for key in list(env):
+                if key.startswith('HDIST_JAIL_') or key == 'LD_PRELOAD':
+                    del env[key]
+            if config['jail']:
+                text, index = whitelists[config['whitelist_size']]
+                env['LD_PRELOAD'] = JAIL_SO
+                env['HDIST_JAIL_MODE'] = 'hide'
+                env['HDIST_JAIL_WHITELIST'] = text if config['whitelist_format'] == 'text' else index
+            for op in ops:
+                iterations = max(1, int(ITERATIONS[op] * args.scale))
+                # exec cost is dominated by process startup; only vary the
+                # whitelist for it
+                cases = ([(depths[0], False)] if op == 'execve' else
+                         [(d, r) for d in depths for r in [False, True]])
+                for depth, relative in cases:
+                    path = rel_paths[depth] if relative else pjoin(tree, rel_paths[depth])
+                    result = run(op, path, iterations, tree, env)
+                    result.update(config)
+                    result.update(depth=depth, relative=relative)
+                    out.write(json.dumps(result, sort_keys=True) + '\n')
+                    out.flush()
+    finally:
+        shutil.rmtree(tempdir)
+        if out is not sys.stdout:
+            out.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -5,22 +5,91 @@
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
 
 /*
-getcwd() into a newly allocated buffer; the buffer
-has room for `extra` more bytes
- */
-static char *alloc_getcwd(size_t extra) {
-    size_t n = 256;
-    while (1) {
-        char *buf = malloc(n + extra);
-        if (getcwd(buf, n)) {
-            return buf;
+   Cached working directory.
+
+   Relative paths are resolved against a per-process copy of the working
+   directory instead of calling getcwd() every time. No memory is
+   allocated; the cache is a static PATH_MAX buffer. The owner of the cache
+   must call cwd_cache_invalidate() whenever the working directory may have
+   changed (chdir(), fchdir()), and cwd_cache_reset() in the child after
+   fork(). While a process that shares our memory but not our working
+   directory may run (a child of clone() with CLONE_VM), the owner brackets
+   it with cwd_cache_suspend() and cwd_cache_resume(), and the cache is
+   bypassed meanwhile.
+
+   The cache is protected by a sequence lock: g_cwd_seq is odd while a
+   thread is refreshing g_cwd, and readers retry/fall back to getcwd() if
+   it changed under them. g_cwd_generation is bumped on invalidation; the
+   cached copy is only valid if it was loaded in the current generation.
+*/
+static int g_cwd_cache_enabled = 1;
+static unsigned g_cwd_cache_suspended = 0;
+static unsigned g_cwd_seq = 0;
+static unsigned g_cwd_generation = 1;
+static unsigned g_cwd_cached_generation = 0;
+static size_t g_cwd_len = 0;
+static char g_cwd[PATH_MAX];
+
+static inline void cwd_cache_invalidate(void) {
+    __atomic_add_fetch(&g_cwd_generation, 1, __ATOMIC_RELEASE);
+}
+
+static inline void cwd_cache_suspend(void) {
+    __atomic_add_fetch(&g_cwd_cache_suspended, 1, __ATOMIC_ACQ_REL);
+}
+
+static inline void cwd_cache_resume(void) {
+    cwd_cache_invalidate();
+    __atomic_sub_fetch(&g_cwd_cache_suspended, 1, __ATOMIC_ACQ_REL);
+}
+
+static inline int cwd_cache_active(void) {
+    return g_cwd_cache_enabled && !__atomic_load_n(&g_cwd_cache_suspended, __ATOMIC_ACQUIRE);
+}
+
+/* Only to be called while single-threaded (e.g., in the child after fork()),
+   in case another thread held the sequence lock when forking. */
+static inline void cwd_cache_reset(void) {
+    g_cwd_seq = 0;
+    g_cwd_len = 0;
+    cwd_cache_invalidate();
+}
+
+/* Copies the working directory into buf, which must have room for PATH_MAX
+   bytes. Returns the length, or -1 if it could not be determined (e.g.,
+   the working directory is longer than PATH_MAX). */
+static ssize_t cached_getcwd(char *buf) {
+    unsigned gen = __atomic_load_n(&g_cwd_generation, __ATOMIC_ACQUIRE);
+    unsigned seq = __atomic_load_n(&g_cwd_seq, __ATOMIC_ACQUIRE);
+    size_t n;
+    if (!(seq & 1)) {
+        n = __atomic_load_n(&g_cwd_len, __ATOMIC_RELAXED);
+        if (n != 0 && n < PATH_MAX &&
+            __atomic_load_n(&g_cwd_cached_generation, __ATOMIC_RELAXED) == gen) {
+            memcpy(buf, g_cwd, n + 1);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&g_cwd_seq, __ATOMIC_RELAXED) == seq) return n;
+        }
+        /* refresh, unless another thread is already doing so */
+        if (__atomic_compare_exchange_n(&g_cwd_seq, &seq, seq + 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            if (getcwd(g_cwd, PATH_MAX)) {
+                n = strlen(g_cwd);
+                g_cwd_cached_generation = gen;
+            } else {
+                n = 0;
+            }
+            __atomic_store_n(&g_cwd_len, n, __ATOMIC_RELAXED);
+            memcpy(buf, g_cwd, n + 1);
+            __atomic_store_n(&g_cwd_seq, seq + 2, __ATOMIC_RELEASE);
+            return n ? (ssize_t)n : -1;
         }
-        free(buf);
-        if (errno != ERANGE) return NULL;
-        n *= 2;
     }
+    return getcwd(buf, PATH_MAX) ? (ssize_t)strlen(buf) : -1;
 }
 
 /* normpath: normalize a path name by translating
@@ -38,68 +107,111 @@ static char *alloc_getcwd(size_t extra) {
    Extra '..' that cannot move to parent are skipped. This makes
    sense for absolute paths since '/..' -> '/', but is sort of nonsensical
    for relative paths.
+
+   The work is done in one forward pass: components are copied down to
+   the write position, and '..' moves the write position back over the
+   last component written, so that every byte is visited a bounded number
+   of times whatever the input. Most paths need no rewriting at all, so
+   the prefix that is already normal is first skipped by looking for
+   '/' and '.' a word at a time.
  */
-static void normpath(char *p) {
-    /* note: cannot use strcat, strcpy as buffers overlap */
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/* 0x80 in each byte of x that equals c */
+static inline uint64_t normpath_match(uint64_t x, unsigned char c) {
+    uint64_t y = x ^ (0x0101010101010101ULL * c);
+    return ~(((y & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | y) & 0x8080808080808080ULL;
+}
+#endif
+
+/* Returns the first component in [p, end) that starts with '/' or '.',
+   i.e., may be empty, '.' or '..'; end if there is none */
+static inline char *normpath_skip(char *p, char *end) {
+    int after_slash = 1;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t carry = 0x80, x, slashes, hits;
+    while (end - p >= 8) {
+        memcpy(&x, p, 8);
+        slashes = normpath_match(x, '/');
+        hits = ((slashes << 8) | carry) & (slashes | normpath_match(x, '.'));
+        if (hits) return p + __builtin_ctzll(hits) / 8;
+        carry = slashes >> 56;
+        p += 8;
+    }
+    after_slash = carry != 0;
+#endif
+    for (; p != end; ++p) {
+        if (after_slash && (*p == '/' || *p == '.')) return p;
+        after_slash = *p == '/';
+    }
+    return end;
+}
+
+static void normpath(char *p) {
     /* we keep initial / out of it for absolute paths, then the rest is the same */
-    char *start;
+    char *start, *end, *w, *r, *slash;
+    size_t len;
     if (p[0] == '/') p++;
     start = p;
+    end = p + strlen(p);
 
-    while (1) {
-        /* Strategy: Modify p in place (copying up from the rest of the string)
-           when applying rules. Only if no rules were applied do we search for
-           a new path component (i.e., loop is used as rail recursion).
-
-           Invariant: p[0] is at beginning of next path component (which may
-           be empty). */
-        if (p[0] == 0) {
-            break;
-        } else if (p[0] == '/') {
-            char *dst = p, *src = p + 1;
-            while ((*dst++ = *src++));
-        } else if (p[0] == '.' && p[1] == '/') {
-            char *dst = p, *src = p + 2;
-            while ((*dst++ = *src++));
-        } else if (p[0] == '.' && p[1] == 0) {
-            p[0] = 0; /* leaves trailing / to be stripped off later */
-        } else if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == 0)) {
-            char *rest = p + 2;
-            if (p != start) p -= 2;
-            while  (*p != '/' && p != start) --p;
-            if (*p == '/') ++p;
-            char *dst = p;
-            while ((*dst++ = *rest++));
+    /* Invariant: [start, w) is normalized and consists of components
+       each followed by '/'; r is at the beginning of the next component
+       to be read (which may be empty). */
+    w = r = normpath_skip(start, end);
+    while (r != end) {
+        slash = memchr(r, '/', end - r);
+        if (slash == NULL) slash = end;
+        len = slash - r;
+        if (len == 0 || (len == 1 && r[0] == '.')) {
+            /* drop */
+        } else if (len == 2 && r[0] == '.' && r[1] == '.') {
+            if (w != start) {
+                --w;
+                while (w != start && w[-1] != '/') --w;
+            }
         } else {
-            /* skip ahead to start of next path component */
-            while (*p != 0 && *p != '/') p++;
-            if (*p == '/') p++;
+            if (w != r) memmove(w, r, len);
+            w += len;
+            if (slash != end) *w++ = '/';
         }
+        r = slash == end ? end : slash + 1;
     }
     /* remove trailing / */
-    if (p != start && p[-1] == '/') p[-1] = 0;
+    if (w != start && w[-1] == '/') --w;
+    *w = 0;
 }
 
 
-/* returns the absolute path of `s` *without* resolving symlinks;
+/* abspath: computes the absolute path of `s` *without* resolving symlinks;
    done by concatenating the cwd with s (if it is not absolute already)
-   and then calling normpath. The result must be free()d.
+   and then calling normpath. The cwd is taken from the cache above unless
+   it is disabled or suspended.
 
-   If the path contains too many '..', so that one "escapes the root",
-   NULL is returned.
+   The result is written to `out`, which must have room for PATH_MAX bytes;
+   no memory is allocated. Returns 0 on success, or -1 with errno set if
+   the working directory can not be determined or the result (before
+   normalization) does not fit in PATH_MAX bytes (ENAMETOOLONG).
 */
-static char *abspath(const char *s) {
-    char *path;
+static int abspath(const char *s, char *out) {
+    size_t n = strlen(s), m = 0;
     if (s[0] != '/') {
-        path = alloc_getcwd(strlen(s) + 1);
-        strcat(path, "/");
-        strcat(path, s);
-    } else {
-        path = strdup(s);
+        ssize_t r = cwd_cache_active() ? cached_getcwd(out) :
+            (getcwd(out, PATH_MAX) ? (ssize_t)strlen(out) : -1);
+        if (r == -1) return -1;
+        m = r;
+        if (m + 1 + n >= PATH_MAX) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        out[m++] = '/';
+    } else if (n >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
     }
-    normpath(path);
-    return path;
+    memcpy(out + m, s, n + 1);
+    normpath(out);
+    return 0;
 }
 
 #endif
@@ -0,0 +1,113 @@
+/*
+   bench_jail: times a loop of one hooked call, for measuring the overhead
+   of the jail (run it with and without LD_PRELOAD; see bench_jail.py,
+   which drives it for `make bench`).
+
+   Usage: bench_jail op path iterations
+
+   op is one of open, stat, access, fopen or execve. For execve, the
+   program re-executes itself through `path` (which must refer to this
+   program) until the iterations are used up, so that each iteration
+   includes loading and initializing the jail.
+
+   Prints one JSON object with the op, path, iterations, ns_per_call and
+   calls_per_sec.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define HEADER "bench_jail: "
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char *op, const char *path, long iterations, uint64_t ns) {
+    double per_call = (double)ns / iterations;
+    printf("{\"op\": \"%s\", \"path\": \"%s\", \"iterations\": %ld, "
+           "\"ns_per_call\": %.1f, \"calls_per_sec\": %.0f}\n",
+           op, path, iterations, per_call, 1e9 / per_call);
+}
+
+static void fail(const char *what, const char *path) {
+    fprintf(stderr, "%s%s(%s): %s\n", HEADER, what, path, strerror(errno));
+    exit(1);
+}
+
+/* argv for re-execution: op path iterations remaining start_ns */
+static void bench_execve(char *argv[]) {
+    char remaining[32], start[32];
+    char *args[] = {argv[0], argv[1], argv[2], argv[3], remaining, start, NULL};
+    long iterations = atol(argv[3]);
+    long left = argv[4] ? atol(argv[4]) : iterations;
+    uint64_t start_ns = argv[4] ? strtoull(argv[5], NULL, 10) : now_ns();
+    if (left == 0) {
+        report("execve", argv[2], iterations, now_ns() - start_ns);
+        return;
+    }
+    snprintf(remaining, sizeof(remaining), "%ld", left - 1);
+    snprintf(start, sizeof(start), "%llu", (unsigned long long)start_ns);
+    execve(argv[2], args, environ);
+    fail("execve", argv[2]);
+}
+
+int main(int argc, char *argv[]) {
+    const char *op, *path;
+    long iterations, i;
+    uint64_t start;
+    struct stat st;
+
+    if (argc != 4 && !(argc == 6 && strcmp(argv[1], "execve") == 0)) {
+        fprintf(stderr, "Usage: %s open|stat|access|fopen|execve path iterations\n", argv[0]);
+        return 2;
+    }
+    op = argv[1];
+    path = argv[2];
+    iterations = atol(argv[3]);
+    if (iterations <= 0) {
+        fprintf(stderr, "%sinvalid number of iterations: %s\n", HEADER, argv[3]);
+        return 2;
+    }
+    if (strcmp(op, "execve") == 0) {
+        bench_execve(argv);
+        return 0;
+    }
+
+    start = now_ns();
+    if (strcmp(op, "open") == 0) {
+        for (i = 0; i != iterations; ++i) {
+            int fd = open(path, O_RDONLY);
+            if (fd == -1) fail("open", path);
+            close(fd);
+        }
+    } else if (strcmp(op, "stat") == 0) {
+        for (i = 0; i != iterations; ++i) {
+            if (stat(path, &st) != 0) fail("stat", path);
+        }
+    } else if (strcmp(op, "access") == 0) {
+        for (i = 0; i != iterations; ++i) {
+            if (access(path, R_OK) != 0) fail("access", path);
+        }
+    } else if (strcmp(op, "fopen") == 0) {
+        for (i = 0; i != iterations; ++i) {
+            FILE *f = fopen(path, "r");
+            if (f == NULL) fail("fopen", path);
+            fclose(f);
+        }
+    } else {
+        fprintf(stderr, "%sunknown op: %s\n", HEADER, op);
+        return 2;
+    }
+    report(op, path, iterations, now_ns() - start);
+    return 0;
+}
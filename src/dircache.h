@@ -0,0 +1,27 @@
+#ifndef _8c41d2e7_5b09_4a63_b7f0_2e9d61a4c35f
+#define _8c41d2e7_5b09_4a63_b7f0_2e9d61a4c35f
+
+/*
+   Directory cache: a bounded, per-process map from a canonical directory
+   to where walking it ends in the whitelist (a wlindex_cursor_t: below a
+   prefix entry, not in the trie, or at a trie node, plus the DFA state
+   of the patterns). A file is then checked with one cache hit for its
+   parent directory and one lookup of its name, however deep it is; this
+   matters most for large directories that are read file by file.
+
+   Unlike the verdict cache (vcache.h) the key is canonical, so entries
+   are only tagged with the whitelist generation they were computed in.
+   The layout, replacement and locking are those of setcache.h.
+*/
+
+#include <stdint.h>
+
+#include "setcache.h"
+#include "wlindex.h"
+
+#define DIRCACHE_SETS 128
+#define DIRCACHE_KEY_MAX 228
+
+SETCACHE_INIT(dircache, DIRCACHE_SETS, DIRCACHE_KEY_MAX, uint32_t, wlindex_cursor_t)
+
+#endif
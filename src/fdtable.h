@@ -0,0 +1,173 @@
+#ifndef _b81f4d27_9e35_4c0a_a6d3_2f71c8e05b94
+#define _b81f4d27_9e35_4c0a_a6d3_2f71c8e05b94
+
+/*
+   Per-process table from file descriptors to the canonical path they were
+   opened with, used to resolve paths relative to a directory fd (openat()
+   and friends) without a readlink("/proc/self/fd/N") for every call.
+
+   The owner of the table records the path of every directory opened by a
+   hooked call (with or without O_DIRECTORY, O_PATH, opendir()), clears
+   the entry of every other fd returned by a hooked open, and keeps the
+   table up to date on close(), closedir(), dup*() and close_range(). The
+   table dies with the process image on exec. For fds that are not in the
+   table (inherited, opened through a call that is not hooked, or with a
+   path too long for the table), fdtable_get() falls back to
+   /proc/self/fd and caches the result; that path is the kernel's, with
+   symlinks resolved like in getcwd(), where the recorded ones are taken
+   as given.
+
+   While a process that shares our memory may run (a child of clone()
+   with CLONE_VM), the owner brackets it with fdtable_suspend() and
+   fdtable_resume(): the table is neither consulted nor updated
+   meanwhile, and is emptied on resuming, since the fds it describes may
+   have changed under it.
+
+   The table is static (fds up to FDTABLE_FDS, paths up to
+   FDTABLE_PATH_MAX bytes); no memory is allocated. Each entry is
+   protected by a sequence lock: writers take it by making the sequence
+   odd, readers copy the path out and retry if it changed.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "abspath.h"
+
+#define FDTABLE_FDS 1024
+#define FDTABLE_PATH_MAX 250
+
+typedef struct {
+    uint32_t seq;
+    uint16_t len; /* 0 if unknown */
+    char path[FDTABLE_PATH_MAX];
+} fdtable_entry_t;
+
+static fdtable_entry_t g_fdtable[FDTABLE_FDS];
+static uint64_t g_fdtable_fallbacks = 0;
+static unsigned g_fdtable_suspended = 0;
+
+static inline uint32_t fdtable_lock(fdtable_entry_t *e) {
+    uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+    while ((seq & 1) || !__atomic_compare_exchange_n(&e->seq, &seq, seq + 1, 1,
+                                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        sched_yield();
+        seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+    }
+    return seq;
+}
+
+static inline void fdtable_store(int fd, const char *path, size_t n) {
+    fdtable_entry_t *e = &g_fdtable[fd];
+    uint32_t seq;
+    if (path == NULL || n >= FDTABLE_PATH_MAX) {
+        /* cheap check for the common case of an fd that was never recorded */
+        if (__atomic_load_n(&e->len, __ATOMIC_RELAXED) == 0 &&
+            !(__atomic_load_n(&e->seq, __ATOMIC_RELAXED) & 1)) return;
+        path = NULL;
+        n = 0;
+    }
+    seq = fdtable_lock(e);
+    memcpy(e->path, path, n);
+    e->path[n] = 0;
+    e->len = n;
+    __atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Records `path` (of `n` bytes) for `fd`, or forgets `fd` if path is NULL
+   or too long */
+static inline void fdtable_set(int fd, const char *path, size_t n) {
+    if (fd < 0 || fd >= FDTABLE_FDS ||
+        __atomic_load_n(&g_fdtable_suspended, __ATOMIC_ACQUIRE)) return;
+    fdtable_store(fd, path, n);
+}
+
+static inline void fdtable_suspend(void) {
+    __atomic_add_fetch(&g_fdtable_suspended, 1, __ATOMIC_ACQ_REL);
+}
+
+static inline void fdtable_resume(void) {
+    int fd;
+    for (fd = 0; fd != FDTABLE_FDS; ++fd) fdtable_store(fd, NULL, 0);
+    __atomic_sub_fetch(&g_fdtable_suspended, 1, __ATOMIC_ACQ_REL);
+}
+
+static inline void fdtable_clear(int fd) {
+    fdtable_set(fd, NULL, 0);
+}
+
+/* For dup2() and friends */
+static inline void fdtable_copy(int oldfd, int newfd) {
+    char buf[FDTABLE_PATH_MAX];
+    fdtable_entry_t *e;
+    uint32_t seq;
+    size_t n = 0;
+    if (oldfd >= 0 && oldfd < FDTABLE_FDS) {
+        e = &g_fdtable[oldfd];
+        seq = fdtable_lock(e);
+        n = e->len;
+        memcpy(buf, e->path, n);
+        __atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);
+    }
+    fdtable_set(newfd, n ? buf : NULL, n);
+}
+
+/* Copies the path of `fd` into buf (room for PATH_MAX bytes). Returns the
+   length, or -1 if it can not be determined. */
+static inline ssize_t fdtable_get(int fd, char *buf) {
+    char proc_path[32];
+    ssize_t n;
+    if (fd >= 0 && fd < FDTABLE_FDS &&
+        !__atomic_load_n(&g_fdtable_suspended, __ATOMIC_ACQUIRE)) {
+        fdtable_entry_t *e = &g_fdtable[fd];
+        int tries;
+        for (tries = 0; tries != 3; ++tries) {
+            uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) continue;
+            n = __atomic_load_n(&e->len, __ATOMIC_RELAXED);
+            if (n == 0) break;
+            memcpy(buf, e->path, n);
+            buf[n] = 0;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq) return n;
+        }
+    }
+    __atomic_fetch_add(&g_fdtable_fallbacks, 1, __ATOMIC_RELAXED);
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+    /* the raw syscall, since readlink() itself is hooked */
+    n = syscall(SYS_readlinkat, AT_FDCWD, proc_path, buf, PATH_MAX - 1);
+    if (n <= 0 || buf[0] != '/') return -1;
+    buf[n] = 0;
+    fdtable_set(fd, buf, n);
+    return n;
+}
+
+/* Like abspath(), but relative paths are taken relative to the directory
+   open as `dirfd` unless it is AT_FDCWD */
+static int abspath_at(int dirfd, const char *s, char *out) {
+    size_t n, m;
+    ssize_t r;
+    if (dirfd == AT_FDCWD || s[0] == '/') return abspath(s, out);
+    r = fdtable_get(dirfd, out);
+    if (r == -1) {
+        errno = EBADF;
+        return -1;
+    }
+    m = r;
+    n = strlen(s);
+    if (m + 1 + n >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    out[m++] = '/';
+    memcpy(out + m, s, n + 1);
+    normpath(out);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,198 @@
+/*
+   hdistjail-collect: runs a command with a shared-memory log ring (see
+   logring.h) and drains the log entries of the whole process tree to a
+   log file, in the same format as HDIST_JAIL_LOG, or with -b in the
+   binary format of logformat.h.
+
+   Usage: hdistjail-collect [-b] [-o logfile] [-s slots] [-p jail.so] command [args...]
+
+   The ring is created in a memfd which is passed to the command by file
+   descriptor through HDIST_JAIL_LOG_RING=<collector pid>:<fd>; processes
+   that lost the descriptor reopen it through /proc/<pid>/fd/<fd>. A
+   process that gives up on the ring (see logring.h) logs to
+   `logfile`.overflow instead, which is removed at the end if empty. The
+   collector itself should run outside the jail; with -p, LD_PRELOAD is
+   set to the given jail library for the command only. The exit status is
+   that of the command.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "logring.h"
+#include "logformat.h"
+
+#define HEADER "hdistjail-collect: "
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-b] [-o logfile] [-s slots] [-p jail.so] command [args...]\n", argv0);
+    exit(2);
+}
+
+/* With -b, action names are interned in the order they are first seen */
+static int g_binary = 0;
+static char *g_action_names[256];
+static int g_n_actions = 0;
+
+static void write_binary(FILE *out, const logring_record_t *rec,
+                         const char *action, const char *path) {
+    static char record[LOGFMT_MAX_RECORD];
+    size_t n;
+    int id;
+    for (id = 0; id != g_n_actions && strcmp(g_action_names[id], action) != 0; ++id);
+    if (id == g_n_actions) {
+        if (g_n_actions == 256) return;
+        g_action_names[g_n_actions++] = strdup(action);
+        n = logfmt_encode(record, sizeof(record), LOGFMT_ACTION, id, rec->pid, NULL,
+                          action, strlen(action));
+        fwrite(record, 1, n, out);
+    }
+    n = logfmt_encode(record, sizeof(record), LOGFMT_ENTRY, id, rec->pid, NULL,
+                      path, rec->path_len);
+    fwrite(record, 1, n, out);
+}
+
+/* Abandons the record at the tail if the tail has not moved from
+   `tail` (nor has the ring been empty) for `timeout` ns */
+static void poll_abandon(logring_t *ring, uint64_t tail, uint64_t *stuck_since, uint64_t timeout) {
+    uint64_t now = logring_now();
+    if (ring->header->tail != tail ||
+        __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE) == ring->header->tail) {
+        *stuck_since = now;
+    } else if (now - *stuck_since > timeout) {
+        logring_abandon(ring);
+        *stuck_since = now;
+    }
+}
+
+static void drain(logring_t *ring, FILE *out, unsigned long long *n_records) {
+    logring_record_t rec;
+    static char action[256], path[PATH_MAX + 1];
+    while (logring_pop(ring, &rec, action, path)) {
+        if (g_binary) {
+            write_binary(out, &rec, action, path);
+        } else {
+            fprintf(out, "%d %s// %s\n", (int)rec.pid, path, action);
+        }
+        (*n_records)++;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *log_filename = "jail.log", *preload = NULL;
+    unsigned long n_slots = 16384;
+    int opt, fd, status;
+    size_t size;
+    void *buf;
+    logring_t ring;
+    FILE *out;
+    pid_t child;
+    char env[64], *overflow;
+    unsigned long long n_records = 0;
+    uint64_t stuck_since;
+    struct stat st;
+
+    while ((opt = getopt(argc, argv, "+bo:s:p:")) != -1) {
+        switch (opt) {
+        case 'b': g_binary = 1; break;
+        case 'o': log_filename = optarg; break;
+        case 'p': preload = optarg; break;
+        case 's': n_slots = strtoul(optarg, NULL, 10); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind == argc) usage(argv[0]);
+    if (n_slots < 64 || (n_slots & (n_slots - 1)) != 0) {
+        fprintf(stderr, "%snumber of slots must be a power of two >= 64\n", HEADER);
+        return 2;
+    }
+
+    size = logring_size(n_slots);
+    fd = memfd_create("hdistjail-logring", 0);
+    if (fd == -1 || ftruncate(fd, size) != 0) {
+        fprintf(stderr, "%sCould not create log ring: %s\n", HEADER, strerror(errno));
+        return 1;
+    }
+    buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buf == MAP_FAILED) {
+        fprintf(stderr, "%sCould not map log ring: %s\n", HEADER, strerror(errno));
+        return 1;
+    }
+    logring_init(buf, n_slots, getpid());
+    logring_open(&ring, buf, size);
+
+    out = fopen(log_filename, "a");
+    if (out == NULL) {
+        fprintf(stderr, "%sCould not create log file (%s): %s\n", HEADER,
+                strerror(errno), log_filename);
+        return 1;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    sprintf(env, "%d:%d", (int)getpid(), fd);
+    setenv("HDIST_JAIL_LOG_RING", env, 1);
+    if (asprintf(&overflow, "%s.overflow", log_filename) == -1) {
+        fprintf(stderr, "%sOut of memory\n", HEADER);
+        return 1;
+    }
+    setenv("HDIST_JAIL_LOG", overflow, 1);
+    setenv("HDIST_JAIL_LOG_FORMAT", g_binary ? "binary" : "text", 1);
+    child = fork();
+    if (child == -1) {
+        fprintf(stderr, "%sfork failed: %s\n", HEADER, strerror(errno));
+        return 1;
+    } else if (child == 0) {
+        if (preload) setenv("LD_PRELOAD", preload, 1);
+        execvp(argv[optind], argv + optind);
+        fprintf(stderr, "%sCould not execute %s: %s\n", HEADER, argv[optind], strerror(errno));
+        _exit(127);
+    }
+
+    stuck_since = logring_now();
+    while (1) {
+        struct timespec ts = {0, 1000000};
+        uint64_t tail = ring.header->tail;
+        drain(&ring, out, &n_records);
+        if (waitpid(child, &status, WNOHANG) == child) break;
+        if (ring.header->tail == tail) nanosleep(&ts, NULL);
+        poll_abandon(&ring, tail, &stuck_since, LOGRING_ABANDON_NS);
+    }
+    {
+        /* give records that are still being written by the remaining
+           processes of the tree a moment to complete, abandoning those
+           that do not progress sooner than while running */
+        int i;
+        for (i = 0; i != 1000; ++i) {
+            struct timespec ts = {0, 1000000};
+            uint64_t tail = ring.header->tail;
+            drain(&ring, out, &n_records);
+            if (__atomic_load_n(&ring.header->head, __ATOMIC_ACQUIRE) == ring.header->tail) break;
+            nanosleep(&ts, NULL);
+            poll_abandon(&ring, tail, &stuck_since, LOGRING_ABANDON_NS / 20);
+        }
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "%sError writing %s: %s\n", HEADER, log_filename, strerror(errno));
+        return 1;
+    }
+    if (ring.header->dropped) {
+        fprintf(stderr, "%s%llu records dropped\n", HEADER,
+                (unsigned long long)ring.header->dropped);
+    }
+    if (stat(overflow, &st) == 0) {
+        if (st.st_size == 0) {
+            unlink(overflow);
+        } else {
+            fprintf(stderr, "%ssome processes gave up on the ring and logged to %s\n",
+                    HEADER, overflow);
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
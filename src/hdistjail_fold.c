@@ -0,0 +1,335 @@
+/*
+   hdistjail-fold: folds the paths accessed during a run, as logged with
+   HDIST_JAIL_MODE=learn, into a small whitelist of exact and prefix
+   entries.
+
+   Usage: hdistjail-fold [-r percent] [-m count] [-d depth] [-o whitelist] [logfile...]
+
+   The logs may be in the text or the binary format (told apart by their
+   first bytes), and are read from stdin if none are given; traces of
+   HDIST_JAIL_RECORD work too. Paths that are not absolute, truncated
+   entries and paths containing a newline are skipped.
+
+   The distinct paths are put into a tree, which is folded bottom-up
+   against the file system as it is now: a directory is replaced by a
+   prefix entry (everything beneath it) once at least `percent` (default
+   50) percent of its entries, and at least `count` (default 4) of them,
+   were used, where an entry counts as used if it was accessed itself or
+   is a directory that was folded. Directories less than `depth`
+   (default 2) components deep, and directories that can not be listed,
+   are never folded. Everything else is kept as an exact entry. The
+   whitelist is written sorted to `whitelist`, or to stdout, and a
+   summary to stderr.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "logformat.h"
+#include "khash.h"
+
+#define HEADER "hdistjail-fold: "
+
+KHASH_SET_INIT_STR(path)
+
+typedef struct node {
+    char *name;
+    struct node **children;
+    uint32_t n_children, capacity;
+    uint8_t accessed;
+    uint8_t folded;
+} node_t;
+
+static khash_t(path) *g_paths;
+static uint64_t g_n_skipped = 0;
+static long g_percent = 50, g_min_used = 4, g_min_depth = 2;
+static uint64_t g_n_exact = 0, g_n_prefixes = 0;
+
+static void out_of_memory(void) {
+    fprintf(stderr, "%sOut of memory\n", HEADER);
+    exit(1);
+}
+
+static void *checked_realloc(void *p, size_t n) {
+    p = realloc(p, n);
+    if (!p) out_of_memory();
+    return p;
+}
+
+static char *checked_strndup(const char *s, size_t n) {
+    char *copy = strndup(s, n);
+    if (!copy) out_of_memory();
+    return copy;
+}
+
+static void add_path(const char *data, size_t len) {
+    char *path;
+    int ret;
+    if (len == 0 || data[0] != '/' || memchr(data, '\n', len)) {
+        g_n_skipped++;
+        return;
+    }
+    path = checked_strndup(data, len);
+    kh_put(path, g_paths, path, &ret);
+    if (ret == 0) free(path);
+}
+
+static char *read_all(int fd, size_t *size) {
+    size_t capacity = 1 << 20, n = 0;
+    char *buf = checked_realloc(NULL, capacity);
+    ssize_t r;
+    while ((r = read(fd, buf + n, capacity - n)) != 0) {
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            free(buf);
+            return NULL;
+        }
+        n += r;
+        if (n == capacity) buf = checked_realloc(buf, capacity *= 2);
+    }
+    *size = n;
+    return buf;
+}
+
+static void read_binary(const char *name, const char *buf, size_t size) {
+    size_t pos = 0;
+    while (pos != size) {
+        logfmt_record_t rec;
+        uint64_t timestamp;
+        const char *data;
+        size_t len;
+        int n = logfmt_decode(buf + pos, size - pos, &rec, &timestamp, &data, &len);
+        if (n <= 0) {
+            fprintf(stderr, "%s%s: corrupt binary log at offset %llu\n",
+                    HEADER, name, (unsigned long long)pos);
+            exit(1);
+        }
+        pos += n;
+        if ((rec.type & LOGFMT_TYPE_MASK) != LOGFMT_ENTRY) continue;
+        if (rec.type & LOGFMT_TRUNCATED) {
+            g_n_skipped++;
+        } else {
+            add_path(data, len);
+        }
+    }
+}
+
+/* Lines are "pid path// action"; the path may contain newlines but not
+   "//", and an entry that did not fit into a line was cut short and
+   ends in "<" without the terminator */
+static void read_text(const char *buf, size_t size) {
+    const char *p = buf, *end = buf + size;
+    while (p != end) {
+        const char *path = memchr(p, ' ', end - p), *eol;
+        const char *term = path ? memmem(path, end - path, "// ", 3) : NULL;
+        if (term && term - p < LOGFMT_MAX_RECORD) {
+            add_path(path + 1, term - path - 1);
+            eol = memchr(term, '\n', end - term);
+        } else {
+            g_n_skipped++;
+            eol = memchr(p, '\n', end - p);
+        }
+        p = eol ? eol + 1 : end;
+    }
+}
+
+static void read_log(const char *name, int fd) {
+    logfmt_record_t rec;
+    uint64_t timestamp;
+    const char *data;
+    size_t size, len;
+    char *buf = read_all(fd, &size);
+    if (!buf) {
+        fprintf(stderr, "%sError reading %s: %s\n", HEADER, name, strerror(errno));
+        exit(1);
+    }
+    /* a text log starts with the digits of a pid, which do not make a
+       valid record size and type */
+    if (size != 0 && logfmt_decode(buf, size, &rec, &timestamp, &data, &len) > 0) {
+        read_binary(name, buf, size);
+    } else {
+        read_text(buf, size);
+    }
+    free(buf);
+}
+
+/* Orders paths component by component ('/' before any other byte), so
+   that the children of a directory come out sorted and together */
+static int path_cmp(const void *a, const void *b) {
+    const unsigned char *x = *(const unsigned char **)a, *y = *(const unsigned char **)b;
+    for (; *x && *x == *y; ++x, ++y);
+    if (*x == *y) return 0;
+    if (*x == 0 || *y == 0) return *x ? 1 : -1;
+    if (*x == '/' || *y == '/') return *x == '/' ? -1 : 1;
+    return *x < *y ? -1 : 1;
+}
+
+static node_t *new_child(node_t *parent, const char *name, size_t len) {
+    node_t *child = checked_realloc(NULL, sizeof(node_t));
+    memset(child, 0, sizeof(node_t));
+    child->name = checked_strndup(name, len);
+    if (parent->n_children == parent->capacity) {
+        parent->capacity = parent->capacity ? 2 * parent->capacity : 4;
+        parent->children = checked_realloc(parent->children, parent->capacity * sizeof(node_t *));
+    }
+    parent->children[parent->n_children++] = child;
+    return child;
+}
+
+/* Paths must be inserted in path_cmp() order: a component is then
+   either the last child of its parent or a new one */
+static void insert(node_t *root, const char *path) {
+    node_t *node = root;
+    const char *p = path + 1;
+    while (*p) {
+        const char *end = strchrnul(p, '/');
+        node_t *last = node->n_children ? node->children[node->n_children - 1] : NULL;
+        if (last && strlen(last->name) == (size_t)(end - p) && memcmp(last->name, p, end - p) == 0) {
+            node = last;
+        } else {
+            node = new_child(node, p, end - p);
+        }
+        p = *end ? end + 1 : end;
+    }
+    node->accessed = 1;
+}
+
+/* Folds the directory `path` (of length n, in a PATH_MAX buffer, "" for
+   the root) bottom-up */
+static void fold(node_t *node, char *path, size_t n, long depth) {
+    long n_entries = 0, n_used = 0;
+    struct dirent *ent;
+    uint32_t i;
+    DIR *dir;
+    for (i = 0; i != node->n_children; ++i) {
+        node_t *child = node->children[i];
+        size_t len = strlen(child->name);
+        if (child->n_children == 0 || n + 1 + len >= PATH_MAX) continue;
+        path[n] = '/';
+        memcpy(path + n + 1, child->name, len + 1);
+        fold(child, path, n + 1 + len, depth + 1);
+        path[n] = 0;
+    }
+    if (depth < g_min_depth || g_percent > 100 || node->n_children < (uint32_t)g_min_used) return;
+    if ((dir = opendir(n ? path : "/")) == NULL) return;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) n_entries++;
+    }
+    for (i = 0; i != node->n_children; ++i) {
+        node_t *child = node->children[i];
+        struct stat st;
+        if ((child->accessed || child->folded) &&
+            fstatat(dirfd(dir), child->name, &st, AT_SYMLINK_NOFOLLOW) == 0) n_used++;
+    }
+    closedir(dir);
+    node->folded = n_entries != 0 && n_used >= g_min_used && n_used * 100 >= g_percent * n_entries;
+}
+
+/* Writes path[0:n] plus `suffix` as a whitelist entry; an entry that
+   would contain a wildcard is escaped, and becomes a pattern */
+static void write_entry(FILE *out, const char *path, size_t n, const char *suffix) {
+    size_t i;
+    if (strcspn(path, "*?[") == n) {
+        fprintf(out, "%s%s\n", n ? path : "/", suffix);
+        return;
+    }
+    for (i = 0; i != n; ++i) {
+        if (strchr("*?[\\", path[i])) fputc('\\', out);
+        fputc(path[i], out);
+    }
+    fprintf(out, "%s\n", suffix);
+}
+
+static void emit(FILE *out, node_t *node, char *path, size_t n) {
+    uint32_t i;
+    if (node->accessed) {
+        write_entry(out, path, n, "");
+        g_n_exact++;
+    }
+    if (node->folded) {
+        write_entry(out, path, n, "/**");
+        g_n_prefixes++;
+        return;
+    }
+    for (i = 0; i != node->n_children; ++i) {
+        node_t *child = node->children[i];
+        size_t len = strlen(child->name);
+        if (n + 1 + len >= PATH_MAX) continue;
+        path[n] = '/';
+        memcpy(path + n + 1, child->name, len + 1);
+        emit(out, child, path, n + 1 + len);
+        path[n] = 0;
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-r percent] [-m count] [-d depth] [-o whitelist] [logfile...]\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = NULL;
+    char path[PATH_MAX] = "", **paths;
+    node_t root;
+    FILE *out = stdout;
+    size_t n_paths = 0, j;
+    khiter_t k;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "r:m:d:o:")) != -1) {
+        switch (opt) {
+        case 'r': g_percent = strtol(optarg, NULL, 10); break;
+        case 'm': g_min_used = strtol(optarg, NULL, 10); break;
+        case 'd': g_min_depth = strtol(optarg, NULL, 10); break;
+        case 'o': output = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (g_percent < 1 || g_min_used < 1 || g_min_depth < 1) usage(argv[0]);
+
+    g_paths = kh_init(path);
+    if (optind == argc) read_log("stdin", 0);
+    for (i = optind; i < argc; ++i) {
+        int fd = open(argv[i], O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "%sCould not open %s: %s\n", HEADER, argv[i], strerror(errno));
+            return 1;
+        }
+        read_log(argv[i], fd);
+        close(fd);
+    }
+
+    paths = checked_realloc(NULL, (kh_size(g_paths) + 1) * sizeof(char *));
+    for (k = kh_begin(g_paths); k != kh_end(g_paths); ++k) {
+        if (kh_exist(g_paths, k)) paths[n_paths++] = (char *)kh_key(g_paths, k);
+    }
+    qsort(paths, n_paths, sizeof(char *), path_cmp);
+    memset(&root, 0, sizeof(root));
+    for (j = 0; j != n_paths; ++j) insert(&root, paths[j]);
+    fold(&root, path, 0, 0);
+
+    if (output && (out = fopen(output, "w")) == NULL) {
+        fprintf(stderr, "%sCould not open %s: %s\n", HEADER, output, strerror(errno));
+        return 1;
+    }
+    emit(out, &root, path, 0);
+    if (fflush(out) != 0 || (output && fclose(out) != 0)) {
+        fprintf(stderr, "%sError writing %s: %s\n", HEADER, output ? output : "stdout",
+                strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "%s%llu paths folded into %llu entries (%llu exact, %llu /**), "
+            "%llu skipped\n", HEADER, (unsigned long long)n_paths,
+            (unsigned long long)(g_n_exact + g_n_prefixes), (unsigned long long)g_n_exact,
+            (unsigned long long)g_n_prefixes, (unsigned long long)g_n_skipped);
+    return 0;
+}
@@ -0,0 +1,265 @@
+/*
+   hdistjail-logstat: decodes and summarizes binary jail logs (see
+   logformat.h), as written with HDIST_JAIL_LOG_FORMAT=binary or by
+   hdistjail-collect -b.
+
+   Usage: hdistjail-logstat [-d] [-n count] [logfile]
+
+   With -d, the log is decoded to the text format of HDIST_JAIL_LOG.
+   Otherwise a summary is printed: the number of entries, processes and
+   distinct paths, the entries per action, and the `count` (default 20)
+   paths and processes with the most entries. The log is read from stdin
+   if no file is given. It is streamed in large blocks and only the
+   aggregates are kept in memory.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "logformat.h"
+#include "khash.h"
+
+#define HEADER "hdistjail-logstat: "
+#define BLOCK_SIZE (1 << 20)
+
+KHASH_MAP_INIT_STR(path, uint32_t)
+KHASH_MAP_INIT_INT(pid, uint32_t)
+KHASH_SET_INIT_INT64(pair)
+
+typedef struct {
+    char *path;
+    uint64_t count;
+    uint32_t n_pids;
+} path_stats_t;
+
+typedef struct {
+    uint32_t pid;
+    uint64_t count;
+    uint32_t n_paths;
+    uint64_t first_timestamp, last_timestamp;
+} pid_stats_t;
+
+static char *g_action_names[256];
+static uint64_t g_action_counts[256];
+static uint64_t g_n_entries = 0, g_n_truncated = 0;
+static int g_has_timestamps = 0;
+
+static khash_t(path) *g_path_index;
+static path_stats_t *g_paths = NULL;
+static size_t g_n_paths = 0, g_paths_capacity = 0;
+
+static khash_t(pid) *g_pid_index;
+static pid_stats_t *g_pids = NULL;
+static size_t g_n_pids = 0, g_pids_capacity = 0;
+
+/* (pid, path) pairs seen, to count distinct paths per process and
+   distinct processes per path */
+static khash_t(pair) *g_pairs;
+
+static void *checked_realloc(void *p, size_t n) {
+    p = realloc(p, n);
+    if (!p) {
+        fprintf(stderr, "%sOut of memory\n", HEADER);
+        exit(1);
+    }
+    return p;
+}
+
+static const char *action_name(int action) {
+    static char unknown[16];
+    if (g_action_names[action]) return g_action_names[action];
+    snprintf(unknown, sizeof(unknown), "#%d", action);
+    return unknown;
+}
+
+static uint32_t intern_path(const char *data, size_t len) {
+    static char key[LOGFMT_MAX_RECORD + 1];
+    khiter_t k;
+    int ret;
+    memcpy(key, data, len);
+    key[len] = 0;
+    k = kh_get(path, g_path_index, key);
+    if (k != kh_end(g_path_index)) return kh_value(g_path_index, k);
+    if (g_n_paths == g_paths_capacity) {
+        g_paths_capacity = g_paths_capacity ? 2 * g_paths_capacity : 1024;
+        g_paths = checked_realloc(g_paths, g_paths_capacity * sizeof(path_stats_t));
+    }
+    g_paths[g_n_paths].path = strdup(key);
+    g_paths[g_n_paths].count = 0;
+    g_paths[g_n_paths].n_pids = 0;
+    k = kh_put(path, g_path_index, g_paths[g_n_paths].path, &ret);
+    kh_value(g_path_index, k) = g_n_paths;
+    return g_n_paths++;
+}
+
+static uint32_t intern_pid(uint32_t pid, uint64_t timestamp) {
+    khiter_t k;
+    int ret;
+    k = kh_put(pid, g_pid_index, pid, &ret);
+    if (ret == 0) return kh_value(g_pid_index, k);
+    if (g_n_pids == g_pids_capacity) {
+        g_pids_capacity = g_pids_capacity ? 2 * g_pids_capacity : 1024;
+        g_pids = checked_realloc(g_pids, g_pids_capacity * sizeof(pid_stats_t));
+    }
+    memset(&g_pids[g_n_pids], 0, sizeof(pid_stats_t));
+    g_pids[g_n_pids].pid = pid;
+    g_pids[g_n_pids].first_timestamp = timestamp;
+    kh_value(g_pid_index, k) = g_n_pids;
+    return g_n_pids++;
+}
+
+static void add_entry(const logfmt_record_t *rec, uint64_t timestamp,
+                      const char *data, size_t len) {
+    uint32_t path = intern_path(data, len), pid = intern_pid(rec->pid, timestamp);
+    int ret;
+    g_n_entries++;
+    g_action_counts[rec->action]++;
+    if (rec->type & LOGFMT_TRUNCATED) g_n_truncated++;
+    if (rec->type & LOGFMT_TIMESTAMP) g_has_timestamps = 1;
+    g_paths[path].count++;
+    g_pids[pid].count++;
+    g_pids[pid].last_timestamp = timestamp;
+    kh_put(pair, g_pairs, ((uint64_t)rec->pid << 32) | path, &ret);
+    if (ret != 0) {
+        g_paths[path].n_pids++;
+        g_pids[pid].n_paths++;
+    }
+}
+
+static int cmp_path_count(const void *a, const void *b) {
+    const path_stats_t *x = a, *y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return strcmp(x->path, y->path);
+}
+
+static int cmp_pid_count(const void *a, const void *b) {
+    const pid_stats_t *x = a, *y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return x->pid < y->pid ? -1 : x->pid > y->pid;
+}
+
+static void print_summary(size_t top) {
+    size_t i;
+    printf("entries: %llu\n", (unsigned long long)g_n_entries);
+    printf("processes: %llu\n", (unsigned long long)g_n_pids);
+    printf("paths: %llu\n", (unsigned long long)g_n_paths);
+    if (g_n_truncated) printf("truncated: %llu\n", (unsigned long long)g_n_truncated);
+
+    printf("\nentries by action:\n");
+    for (i = 0; i != 256; ++i) {
+        if (g_action_counts[i]) {
+            printf("%12llu  %s\n", (unsigned long long)g_action_counts[i], action_name(i));
+        }
+    }
+
+    qsort(g_paths, g_n_paths, sizeof(path_stats_t), cmp_path_count);
+    printf("\ntop paths:\n%12s  %8s  %s\n", "entries", "pids", "path");
+    for (i = 0; i != g_n_paths && i != top; ++i) {
+        printf("%12llu  %8u  %s\n", (unsigned long long)g_paths[i].count,
+               g_paths[i].n_pids, g_paths[i].path);
+    }
+
+    qsort(g_pids, g_n_pids, sizeof(pid_stats_t), cmp_pid_count);
+    printf("\ntop processes:\n%12s  %8s  ", "entries", "paths");
+    if (g_has_timestamps) printf("%12s  ", "span_ms");
+    printf("pid\n");
+    for (i = 0; i != g_n_pids && i != top; ++i) {
+        printf("%12llu  %8u  ", (unsigned long long)g_pids[i].count, g_pids[i].n_paths);
+        if (g_has_timestamps) {
+            printf("%12.3f  ", (g_pids[i].last_timestamp - g_pids[i].first_timestamp) / 1e6);
+        }
+        printf("%u\n", g_pids[i].pid);
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-d] [-n count] [logfile]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    int opt, fd = 0, decode = 0;
+    size_t top = 20, have = 0;
+    unsigned long long offset = 0;
+    char *buf;
+    const char *filename = "<stdin>";
+
+    while ((opt = getopt(argc, argv, "dn:")) != -1) {
+        switch (opt) {
+        case 'd': decode = 1; break;
+        case 'n': top = strtoul(optarg, NULL, 10); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind + 1 < argc) usage(argv[0]);
+    if (optind + 1 == argc) {
+        filename = argv[optind];
+        fd = open(filename, O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "%sCould not open %s: %s\n", HEADER, filename, strerror(errno));
+            return 1;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    if (decode) {
+        setvbuf(stdout, NULL, _IOFBF, BLOCK_SIZE);
+    } else {
+        g_path_index = kh_init(path);
+        g_pid_index = kh_init(pid);
+        g_pairs = kh_init(pair);
+    }
+
+    /* a record may straddle two blocks, so keep room for one in front */
+    buf = checked_realloc(NULL, BLOCK_SIZE + LOGFMT_MAX_RECORD);
+    while (1) {
+        ssize_t n = read(fd, buf + have, BLOCK_SIZE + LOGFMT_MAX_RECORD - have);
+        size_t pos = 0;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "%sError reading %s: %s\n", HEADER, filename, strerror(errno));
+            return 1;
+        }
+        if (n == 0) break;
+        have += n;
+        while (1) {
+            logfmt_record_t rec;
+            uint64_t timestamp;
+            const char *data;
+            size_t len;
+            int size = logfmt_decode(buf + pos, have - pos, &rec, &timestamp, &data, &len);
+            if (size == 0) break;
+            if (size == -1) {
+                fprintf(stderr, "%s%s: not a binary log, or corrupt at offset %llu\n",
+                        HEADER, filename, offset + pos);
+                return 1;
+            }
+            if ((rec.type & LOGFMT_TYPE_MASK) == LOGFMT_ACTION) {
+                free(g_action_names[rec.action]);
+                g_action_names[rec.action] = strndup(data, len);
+            } else if ((rec.type & LOGFMT_TYPE_MASK) == LOGFMT_CWD) {
+                /* working directories of a trace; the entries are summarized alone */
+            } else if (decode) {
+                printf("%u %.*s// %s\n", rec.pid, (int)len, data, action_name(rec.action));
+            } else {
+                add_entry(&rec, timestamp, data, len);
+            }
+            pos += size;
+        }
+        memmove(buf, buf + pos, have - pos);
+        have -= pos;
+        offset += pos;
+    }
+    if (have != 0) {
+        fprintf(stderr, "%s%s: ignoring incomplete record at end\n", HEADER, filename);
+    }
+    if (!decode) print_summary(top);
+    if (fflush(stdout) != 0) {
+        fprintf(stderr, "%sError writing output: %s\n", HEADER, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,295 @@
+/*
+   hdistjail-replay: feeds a trace recorded with HDIST_JAIL_RECORD (see
+   logformat.h) through the checks of a jail, in-process and without
+   making the calls, to measure how fast the paths of a real build are
+   checked, e.g., to compare whitelists or builds of the jail.
+
+   Usage: hdistjail-replay [-j threads] [-n repeat] -p jail.so trace
+
+   The jail library is dlopen()-ed and configured by the environment as
+   usual (HDIST_JAIL_WHITELIST, HDIST_JAIL_MODE, the caches; with
+   HDIST_JAIL_LOG the cost of logging is included). The whole trace is
+   loaded first. Each of `threads` threads (default 1) then checks every
+   recorded path `repeat` times (default 1), with the recorded action.
+   A single thread enters the recorded working directories as the trace
+   goes, so that relative paths are checked as they were; with several
+   threads, which share the working directory, and for directories that
+   do not exist here, relative paths are made absolute beforehand.
+   Records truncated in the trace are skipped.
+
+   Prints one JSON object with the trace, threads, calls, the number of
+   whitelisted, denied (not whitelisted, but let through) and hidden
+   checks, the time per check in each thread (ns_per_call) and the
+   checks per second over all threads (calls_per_sec).
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logformat.h"
+#include "khash.h"
+
+#define HEADER "hdistjail-replay: "
+
+KHASH_MAP_INIT_INT(pid, uint32_t)
+KHASH_MAP_INIT_STR(cwd, uint32_t)
+
+#define NO_CWD UINT32_MAX
+
+typedef struct {
+    const char *path;
+    uint32_t cwd; /* NO_CWD for absolute paths */
+    int action;   /* id in the jail */
+} call_t;
+
+typedef struct {
+    uint64_t verdicts[3]; /* hidden, denied, whitelisted */
+} counts_t;
+
+static int (*jail_action)(const char *name);
+static int (*jail_access)(int action, const char *path);
+static int (*jail_chdir)(const char *dir);
+
+static call_t *g_calls = NULL;
+static size_t g_n_calls = 0, g_calls_capacity = 0;
+static char **g_cwds = NULL;
+static size_t g_n_cwds = 0;
+static int g_enter_cwds = 1;
+static long g_repeat = 1;
+
+static void out_of_memory(void) {
+    fprintf(stderr, "%sOut of memory\n", HEADER);
+    exit(1);
+}
+
+static void *checked_realloc(void *p, size_t n) {
+    p = realloc(p, n);
+    if (!p) out_of_memory();
+    return p;
+}
+
+static char *checked_strndup(const char *s, size_t n) {
+    char *copy = strndup(s, n);
+    if (!copy) out_of_memory();
+    return copy;
+}
+
+static uint32_t intern_cwd(khash_t(cwd) *index, const char *data, size_t len) {
+    char *cwd = checked_strndup(data, len);
+    khiter_t k;
+    int ret;
+    k = kh_put(cwd, index, cwd, &ret);
+    if (ret == 0) {
+        free(cwd);
+        return kh_value(index, k);
+    }
+    g_cwds = checked_realloc(g_cwds, (g_n_cwds + 1) * sizeof(char *));
+    g_cwds[g_n_cwds] = cwd;
+    kh_value(index, k) = g_n_cwds;
+    return g_n_cwds++;
+}
+
+static void load_trace(const char *filename) {
+    khash_t(pid) *pid_cwds = kh_init(pid);
+    khash_t(cwd) *cwd_index = kh_init(cwd);
+    int actions[256];
+    struct stat st;
+    const char *buf;
+    size_t pos = 0;
+    int fd, i;
+    for (i = 0; i != 256; ++i) actions[i] = -2; /* not defined */
+    fd = open(filename, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "%sCould not open %s: %s\n", HEADER, filename, strerror(errno));
+        exit(1);
+    }
+    buf = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    if (buf == MAP_FAILED) {
+        fprintf(stderr, "%sCould not map %s: %s\n", HEADER, filename, strerror(errno));
+        exit(1);
+    }
+    close(fd);
+    while (pos != (size_t)st.st_size) {
+        logfmt_record_t rec;
+        uint64_t timestamp;
+        const char *data;
+        size_t len;
+        int size = logfmt_decode(buf + pos, st.st_size - pos, &rec, &timestamp, &data, &len);
+        int type = rec.type & LOGFMT_TYPE_MASK;
+        khiter_t k;
+        int ret;
+        if (size <= 0) {
+            fprintf(stderr, "%s%s: not a trace, or corrupt at offset %llu\n",
+                    HEADER, filename, (unsigned long long)pos);
+            exit(1);
+        }
+        pos += size;
+        if (type == LOGFMT_ACTION) {
+            char *name = checked_strndup(data, len);
+            actions[rec.action] = jail_action(name);
+            if (actions[rec.action] == -1) {
+                fprintf(stderr, "%sAction %s of the trace is unknown to the jail\n", HEADER, name);
+                exit(1);
+            }
+            free(name);
+        } else if (type == LOGFMT_CWD) {
+            k = kh_put(pid, pid_cwds, rec.pid, &ret);
+            kh_value(pid_cwds, k) = intern_cwd(cwd_index, data, len);
+        } else if (!(rec.type & LOGFMT_TRUNCATED)) {
+            call_t *call;
+            if (actions[rec.action] == -2) {
+                fprintf(stderr, "%s%s: undefined action at offset %llu\n",
+                        HEADER, filename, (unsigned long long)(pos - size));
+                exit(1);
+            }
+            if (g_n_calls == g_calls_capacity) {
+                g_calls_capacity = g_calls_capacity ? 2 * g_calls_capacity : 4096;
+                g_calls = checked_realloc(g_calls, g_calls_capacity * sizeof(call_t));
+            }
+            call = &g_calls[g_n_calls++];
+            call->path = checked_strndup(data, len);
+            call->action = actions[rec.action];
+            call->cwd = NO_CWD;
+            if (len == 0 || data[0] != '/') {
+                k = kh_get(pid, pid_cwds, rec.pid);
+                if (k != kh_end(pid_cwds)) call->cwd = kh_value(pid_cwds, k);
+            }
+        }
+    }
+    if (st.st_size) munmap((void *)buf, st.st_size);
+    kh_destroy(pid, pid_cwds);
+    kh_destroy(cwd, cwd_index);
+}
+
+/* Makes relative paths absolute, for all working directories or only
+   those that do not exist here */
+static void resolve_relative(int all) {
+    char *missing = checked_realloc(NULL, g_n_cwds + 1);
+    size_t i;
+    for (i = 0; i != g_n_cwds; ++i) {
+        struct stat st;
+        missing[i] = all || stat(g_cwds[i], &st) != 0 || !S_ISDIR(st.st_mode);
+    }
+    for (i = 0; i != g_n_calls; ++i) {
+        call_t *call = &g_calls[i];
+        char *path;
+        if (call->cwd == NO_CWD || !missing[call->cwd]) continue;
+        if (asprintf(&path, "%s/%s", g_cwds[call->cwd], call->path) == -1) out_of_memory();
+        free((char *)call->path);
+        call->path = path;
+        call->cwd = NO_CWD;
+    }
+    free(missing);
+}
+
+static void *replay(void *arg) {
+    counts_t *counts = arg;
+    uint32_t cwd = NO_CWD;
+    long r;
+    size_t i;
+    for (r = 0; r != g_repeat; ++r) {
+        for (i = 0; i != g_n_calls; ++i) {
+            const call_t *call = &g_calls[i];
+            int verdict;
+            if (g_enter_cwds && call->cwd != cwd && call->cwd != NO_CWD) {
+                cwd = call->cwd;
+                if (jail_chdir(g_cwds[cwd]) != 0) {
+                    fprintf(stderr, "%sCould not enter %s: %s\n", HEADER, g_cwds[cwd], strerror(errno));
+                    exit(1);
+                }
+            }
+            verdict = jail_access(call->action, call->path);
+            if (verdict >= 0 && verdict <= 2) counts->verdicts[verdict]++;
+        }
+    }
+    return NULL;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-j threads] [-n repeat] -p jail.so trace\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    const char *jail_so = NULL, *filename;
+    pthread_t *threads;
+    counts_t *counts, total = {{0, 0, 0}};
+    uint64_t start, ns, calls;
+    double per_call;
+    long n_threads = 1, i;
+    void *jail;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:n:p:")) != -1) {
+        switch (opt) {
+        case 'j': n_threads = strtol(optarg, NULL, 10); break;
+        case 'n': g_repeat = strtol(optarg, NULL, 10); break;
+        case 'p': jail_so = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc || !jail_so || n_threads < 1 || g_repeat < 1) usage(argv[0]);
+    filename = argv[optind];
+
+    /* do not record the replay itself */
+    unsetenv("HDIST_JAIL_RECORD");
+    jail = dlopen(jail_so, RTLD_NOW | RTLD_LOCAL);
+    if (!jail) {
+        fprintf(stderr, "%sCould not load %s: %s\n", HEADER, jail_so, dlerror());
+        return 1;
+    }
+    jail_action = (int (*)(const char *))dlsym(jail, "hdistjail_replay_action");
+    jail_access = (int (*)(int, const char *))dlsym(jail, "hdistjail_replay_access");
+    jail_chdir = (int (*)(const char *))dlsym(jail, "hdistjail_replay_chdir");
+    if (!jail_action || !jail_access || !jail_chdir) {
+        fprintf(stderr, "%s%s has no replay entry points\n", HEADER, jail_so);
+        return 1;
+    }
+
+    load_trace(filename);
+    resolve_relative(n_threads > 1);
+    g_enter_cwds = n_threads == 1;
+
+    threads = checked_realloc(NULL, n_threads * sizeof(pthread_t));
+    counts = checked_realloc(NULL, n_threads * sizeof(counts_t));
+    memset(counts, 0, n_threads * sizeof(counts_t));
+    start = now_ns();
+    for (i = 0; i != n_threads; ++i) {
+        if ((errno = pthread_create(&threads[i], NULL, replay, &counts[i])) != 0) {
+            fprintf(stderr, "%sCould not create thread: %s\n", HEADER, strerror(errno));
+            return 1;
+        }
+    }
+    for (i = 0; i != n_threads; ++i) {
+        int k;
+        pthread_join(threads[i], NULL);
+        for (k = 0; k != 3; ++k) total.verdicts[k] += counts[i].verdicts[k];
+    }
+    ns = now_ns() - start;
+    calls = (uint64_t)g_n_calls * g_repeat * n_threads;
+    per_call = calls ? (double)ns / calls : 0;
+    printf("{\"trace\": \"%s\", \"threads\": %ld, \"calls\": %llu, \"whitelisted\": %llu, "
+           "\"denied\": %llu, \"hidden\": %llu, \"ns_per_call\": %.1f, \"calls_per_sec\": %.0f}\n",
+           filename, n_threads, (unsigned long long)calls,
+           (unsigned long long)total.verdicts[2], (unsigned long long)total.verdicts[1],
+           (unsigned long long)total.verdicts[0], per_call * n_threads,
+           per_call ? 1e9 / per_call : 0);
+    return 0;
+}
@@ -0,0 +1,178 @@
+/*
+   hdistjail-stats: sums the per-process records written with
+   HDIST_JAIL_STATS (see jailstats.h) across a whole build.
+
+   Usage: hdistjail-stats [statsfile...]
+
+   Prints the number of processes, the totals, and per hook the calls,
+   the checks that were allowed (whitelisted) and denied, and the mean,
+   median and 99th percentile time of a check. Times are estimated from
+   the log2 histograms: the mean takes the middle of each bucket, and the
+   percentiles are upper bounds. Reads stdin if no file is given.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "khash.h"
+
+#define HEADER "hdistjail-stats: "
+#define STATS_BUCKETS 32 /* as in jailstats.h */
+#define NAME_MAX_LEN 64
+
+KHASH_SET_INIT_INT(pid)
+
+typedef struct {
+    char name[NAME_MAX_LEN];
+    uint64_t calls, allowed, denied;
+    uint64_t ns[STATS_BUCKETS];
+} hook_stats_t;
+
+static hook_stats_t *g_hooks = NULL;
+static size_t g_n_hooks = 0, g_hooks_capacity = 0;
+static khash_t(pid) *g_pids;
+static uint64_t g_n_records = 0, g_n_bad_lines = 0;
+
+static void *checked_realloc(void *p, size_t n) {
+    p = realloc(p, n);
+    if (!p) {
+        fprintf(stderr, "%sOut of memory\n", HEADER);
+        exit(1);
+    }
+    return p;
+}
+
+static hook_stats_t *intern_hook(const char *name) {
+    size_t i;
+    for (i = 0; i != g_n_hooks; ++i) {
+        if (strcmp(g_hooks[i].name, name) == 0) return &g_hooks[i];
+    }
+    if (g_n_hooks == g_hooks_capacity) {
+        g_hooks_capacity = g_hooks_capacity ? 2 * g_hooks_capacity : 64;
+        g_hooks = checked_realloc(g_hooks, g_hooks_capacity * sizeof(hook_stats_t));
+    }
+    memset(&g_hooks[g_n_hooks], 0, sizeof(hook_stats_t));
+    strcpy(g_hooks[g_n_hooks].name, name);
+    return &g_hooks[g_n_hooks++];
+}
+
+/* <pid> <hook> calls=<n> allowed=<n> denied=<n> ns=<bucket>:<n>,... */
+static int parse_line(const char *line) {
+    char name[NAME_MAX_LEN];
+    unsigned long long calls, allowed, denied, count;
+    const char *p;
+    hook_stats_t *h;
+    int pid, n = -1, bucket, ret;
+    if (sscanf(line, "%d %63s calls=%llu allowed=%llu denied=%llu ns=%n",
+               &pid, name, &calls, &allowed, &denied, &n) != 5 || n < 0) return -1;
+    h = intern_hook(name);
+    h->calls += calls;
+    h->allowed += allowed;
+    h->denied += denied;
+    for (p = line + n; *p && *p != '-' && *p != '\n'; ) {
+        if (sscanf(p, "%d:%llu%n", &bucket, &count, &n) != 2 ||
+            bucket < 0 || bucket >= STATS_BUCKETS) return -1;
+        h->ns[bucket] += count;
+        p += n;
+        if (*p == ',') ++p;
+    }
+    kh_put(pid, g_pids, pid, &ret);
+    g_n_records++;
+    return 0;
+}
+
+static void read_stats(FILE *f) {
+    char *line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, f) != -1) {
+        if (parse_line(line) != 0) g_n_bad_lines++;
+    }
+    free(line);
+}
+
+static double bucket_mid_ns(int b) {
+    return b == 0 ? 0 : 1.5 * (double)(1ULL << (b - 1));
+}
+
+static uint64_t total_ns_estimate(const hook_stats_t *h) {
+    double total = 0;
+    int b;
+    for (b = 0; b != STATS_BUCKETS; ++b) total += h->ns[b] * bucket_mid_ns(b);
+    return (uint64_t)total;
+}
+
+/* upper bound of the bucket holding the q-th quantile of checks */
+static uint64_t quantile_ns(const hook_stats_t *h, double q) {
+    uint64_t checks = h->allowed + h->denied, seen = 0;
+    int b;
+    for (b = 0; b != STATS_BUCKETS; ++b) {
+        seen += h->ns[b];
+        if (seen > 0 && seen >= q * checks) return b == 0 ? 0 : 1ULL << b;
+    }
+    return 0;
+}
+
+static int cmp_calls(const void *a, const void *b) {
+    const hook_stats_t *x = a, *y = b;
+    if (x->calls != y->calls) return x->calls < y->calls ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+static void print_summary(void) {
+    hook_stats_t total;
+    size_t i;
+    int b;
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i != g_n_hooks; ++i) {
+        total.calls += g_hooks[i].calls;
+        total.allowed += g_hooks[i].allowed;
+        total.denied += g_hooks[i].denied;
+        for (b = 0; b != STATS_BUCKETS; ++b) total.ns[b] += g_hooks[i].ns[b];
+    }
+    printf("processes: %u\n", kh_size(g_pids));
+    printf("records: %llu\n", (unsigned long long)g_n_records);
+    if (g_n_bad_lines) printf("bad lines: %llu\n", (unsigned long long)g_n_bad_lines);
+    printf("calls: %llu\n", (unsigned long long)total.calls);
+    printf("checked: %llu (allowed %llu, %.1f%%)\n",
+           (unsigned long long)(total.allowed + total.denied), (unsigned long long)total.allowed,
+           total.allowed + total.denied ? 100.0 * total.allowed / (total.allowed + total.denied) : 0.0);
+    printf("time in checks: ~%.3f ms\n", total_ns_estimate(&total) / 1e6);
+
+    qsort(g_hooks, g_n_hooks, sizeof(hook_stats_t), cmp_calls);
+    printf("\n%12s  %12s  %12s  %8s  %8s  %8s  %s\n",
+           "calls", "allowed", "denied", "mean_ns", "p50_ns", "p99_ns", "hook");
+    for (i = 0; i != g_n_hooks; ++i) {
+        const hook_stats_t *h = &g_hooks[i];
+        uint64_t checks = h->allowed + h->denied;
+        printf("%12llu  %12llu  %12llu  %8.0f  %8llu  %8llu  %s\n",
+               (unsigned long long)h->calls, (unsigned long long)h->allowed,
+               (unsigned long long)h->denied,
+               checks ? (double)total_ns_estimate(h) / checks : 0.0,
+               (unsigned long long)quantile_ns(h, 0.5), (unsigned long long)quantile_ns(h, 0.99),
+               h->name);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int i;
+    if (argc > 1 && argv[1][0] == '-' && argv[1][1] != 0) {
+        fprintf(stderr, "Usage: %s [statsfile...]\n", argv[0]);
+        return 2;
+    }
+    g_pids = kh_init(pid);
+    if (argc == 1) read_stats(stdin);
+    for (i = 1; i < argc; ++i) {
+        FILE *f = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "r");
+        if (!f) {
+            fprintf(stderr, "%sCould not open %s: %s\n", HEADER, argv[i], strerror(errno));
+            return 1;
+        }
+        read_stats(f);
+        if (f != stdin) fclose(f);
+    }
+    print_summary();
+    return 0;
+}
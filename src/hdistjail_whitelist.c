@@ -0,0 +1,104 @@
+/*
+   hdistjail-whitelist: compiles a text whitelist into a binary index
+   (see wlindex.h) that the jail can mmap() directly instead of parsing
+   the text file in every process.
+
+   Usage: hdistjail-whitelist input... output.idx
+
+   Several inputs, text whitelists or indexes, are merged into one index,
+   as the jail does for a ':'-separated HDIST_JAIL_WHITELIST.
+
+   The output is written to a temporary file and then renamed into place,
+   so that processes that currently have the old index mapped are not
+   affected.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "wlindex.h"
+
+#define HEADER "hdistjail-whitelist: "
+
+/* Adds one input to the builder; returns 0 on success */
+static int add_input(wlindex_builder_t *b, const char *filename) {
+    char magic[WLINDEX_MAGIC_SIZE];
+    FILE *in = fopen(filename, "r");
+    if (in == NULL) {
+        fprintf(stderr, "%sError reading %s: %s\n", HEADER, filename, strerror(errno));
+        return -1;
+    }
+    if (fread(magic, 1, WLINDEX_MAGIC_SIZE, in) == WLINDEX_MAGIC_SIZE &&
+        memcmp(magic, WLINDEX_MAGIC, WLINDEX_MAGIC_SIZE) == 0) {
+        wlindex_t idx;
+        char *buf = NULL;
+        long size;
+        int r = -1;
+        if (fseek(in, 0, SEEK_END) == 0 && (size = ftell(in)) >= 0 &&
+            (buf = malloc(size)) != NULL && fseek(in, 0, SEEK_SET) == 0 &&
+            fread(buf, 1, size, in) == (size_t)size) {
+            if (wlindex_open(&idx, buf, size) != 0) {
+                fprintf(stderr, "%sInvalid or incompatible whitelist index: %s\n", HEADER, filename);
+            } else if (wlindex_builder_add_index(b, &idx) != 0) {
+                fprintf(stderr, "%sOut of memory\n", HEADER);
+            } else {
+                r = 0;
+            }
+        } else {
+            fprintf(stderr, "%sError reading %s: %s\n", HEADER, filename, strerror(errno));
+        }
+        free(buf);
+        fclose(in);
+        return r;
+    }
+    rewind(in);
+    if (wlindex_builder_add_file(b, in) != 0) {
+        fprintf(stderr, "%sAll entries in %s must be absolute paths\n", HEADER, filename);
+        return -1;
+    }
+    fclose(in);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    wlindex_builder_t b;
+    FILE *out;
+    void *buf;
+    size_t size;
+    char *tmp_filename, *output;
+    int i;
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s input... output.idx\n", argv[0]);
+        return 2;
+    }
+    output = argv[argc - 1];
+    wlindex_builder_init(&b);
+    for (i = 1; i != argc - 1; ++i) {
+        if (add_input(&b, argv[i]) != 0) return 1;
+    }
+
+    buf = wlindex_build(&b, &size);
+    if (buf == NULL) {
+        fprintf(stderr, "%s%s\n", HEADER,
+                errno == E2BIG ? "Patterns too complex to compile" : "Out of memory");
+        return 1;
+    }
+
+    tmp_filename = malloc(strlen(output) + 5);
+    sprintf(tmp_filename, "%s.tmp", output);
+    out = fopen(tmp_filename, "w");
+    if (out == NULL || fwrite(buf, 1, size, out) != size || fclose(out) != 0) {
+        fprintf(stderr, "%sError writing %s: %s\n", HEADER, tmp_filename, strerror(errno));
+        return 1;
+    }
+    if (rename(tmp_filename, output) != 0) {
+        fprintf(stderr, "%sError writing %s: %s\n", HEADER, output, strerror(errno));
+        return 1;
+    }
+    free(tmp_filename);
+    free(buf);
+    wlindex_builder_free(&b);
+    return 0;
+}
@@ -0,0 +1,219 @@
+#ifndef _5d0e7b3a_64c1_4f29_b8d2_91a7e3f0c64b
+#define _5d0e7b3a_64c1_4f29_b8d2_91a7e3f0c64b
+
+/*
+   Per-hook call counters and latency histograms (HDIST_JAIL_STATS).
+
+   Every thread counts into its own block of counters, one per hook, so
+   that the hot path is a few plain increments without atomic
+   read-modify-write or sharing cache lines. Blocks are registered in a
+   global list under a mutex when a thread makes its first hooked call;
+   when the thread exits its counts are added to g_stats_retired and the
+   block is kept on a free list for reuse. stats_dump() merges everything
+   and appends the counts accumulated since the previous dump to a file.
+
+   For each hook we count calls, and for the calls whose path was checked,
+   whether it was whitelisted ("allowed") or not ("denied", whether it was
+   then hidden or only logged), and the time the check took in a log2
+   histogram: bucket b counts checks taking [2^(b-1), 2^b) ns.
+
+   The hook id of the current call is kept in t_stats_hook, so that the
+   check does not need to be told which hook it runs for.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define STATS_BUCKETS 32
+
+typedef struct {
+    uint64_t calls, allowed, denied;
+    uint64_t ns[STATS_BUCKETS];
+} stats_counter_t;
+
+typedef struct stats_block {
+    struct stats_block *next;
+    stats_counter_t c[];
+} stats_block_t;
+
+static int g_stats_enabled = 0;
+static int g_stats_hooks = 0;
+static pthread_mutex_t g_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t g_stats_key;
+static stats_block_t *g_stats_live = NULL, *g_stats_free = NULL;
+/* counts of exited threads, and of everything up to the last dump */
+static stats_counter_t *g_stats_retired = NULL, *g_stats_dumped = NULL;
+static __thread stats_block_t *t_stats = NULL;
+static __thread int t_stats_hook = 0;
+
+static inline size_t stats_size(void) {
+    return sizeof(stats_counter_t) * g_stats_hooks;
+}
+
+static inline uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int stats_bucket(uint64_t ns) {
+    int b = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+    return b < STATS_BUCKETS ? b : STATS_BUCKETS - 1;
+}
+
+/* Only the owning thread writes its counters; others may read them */
+static inline void stats_inc(uint64_t *x) {
+    __atomic_store_n(x, *x + 1, __ATOMIC_RELAXED);
+}
+
+static inline void stats_add(stats_counter_t *dst, const stats_counter_t *src) {
+    int i;
+    dst->calls += __atomic_load_n(&src->calls, __ATOMIC_RELAXED);
+    dst->allowed += __atomic_load_n(&src->allowed, __ATOMIC_RELAXED);
+    dst->denied += __atomic_load_n(&src->denied, __ATOMIC_RELAXED);
+    for (i = 0; i != STATS_BUCKETS; ++i) dst->ns[i] += __atomic_load_n(&src->ns[i], __ATOMIC_RELAXED);
+}
+
+static void stats_thread_exit(void *arg) {
+    stats_block_t *b = arg, **pp;
+    int i;
+    pthread_mutex_lock(&g_stats_mutex);
+    for (i = 0; i != g_stats_hooks; ++i) stats_add(&g_stats_retired[i], &b->c[i]);
+    for (pp = &g_stats_live; *pp; pp = &(*pp)->next) {
+        if (*pp == b) {
+            *pp = b->next;
+            break;
+        }
+    }
+    memset(b->c, 0, stats_size());
+    b->next = g_stats_free;
+    g_stats_free = b;
+    pthread_mutex_unlock(&g_stats_mutex);
+    t_stats = NULL;
+}
+
+/* Enables the counters for `n_hooks` hooks; returns 0 on success */
+static int stats_init(int n_hooks) {
+    void *buf;
+    g_stats_hooks = n_hooks;
+    buf = mmap(NULL, 2 * stats_size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED || pthread_key_create(&g_stats_key, stats_thread_exit) != 0) return -1;
+    g_stats_retired = buf;
+    g_stats_dumped = g_stats_retired + n_hooks;
+    g_stats_enabled = 1;
+    return 0;
+}
+
+static stats_block_t *stats_thread_block(void) {
+    stats_block_t *b;
+    if (t_stats) return t_stats;
+    pthread_mutex_lock(&g_stats_mutex);
+    b = g_stats_free;
+    if (b) {
+        g_stats_free = b->next;
+    } else {
+        b = mmap(NULL, sizeof(stats_block_t) + stats_size(), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (b == MAP_FAILED) b = NULL;
+    }
+    if (b) {
+        b->next = g_stats_live;
+        g_stats_live = b;
+    }
+    pthread_mutex_unlock(&g_stats_mutex);
+    if (b) pthread_setspecific(g_stats_key, b);
+    t_stats = b;
+    return b;
+}
+
+/* Called on entry of every hook */
+static inline void stats_call(int hook) {
+    stats_block_t *b;
+    if (!g_stats_enabled || !(b = stats_thread_block())) return;
+    stats_inc(&b->c[hook].calls);
+    t_stats_hook = hook;
+}
+
+/* Called with the verdict of the check of the current hook's path */
+static inline void stats_check(int allowed, uint64_t ns) {
+    stats_counter_t *c;
+    if (!t_stats) return;
+    c = &t_stats->c[t_stats_hook];
+    stats_inc(allowed ? &c->allowed : &c->denied);
+    stats_inc(&c->ns[stats_bucket(ns)]);
+}
+
+/* In the child after fork(): only the calling thread survives, and the
+   counts so far belong to the parent */
+static void stats_atfork_child(void) {
+    stats_block_t *b, *next;
+    if (!g_stats_enabled) return;
+    pthread_mutex_init(&g_stats_mutex, NULL);
+    for (b = g_stats_live; b; b = next) {
+        next = b->next;
+        memset(b->c, 0, stats_size());
+        if (b != t_stats) {
+            b->next = g_stats_free;
+            g_stats_free = b;
+        }
+    }
+    g_stats_live = t_stats;
+    if (t_stats) t_stats->next = NULL;
+    memset(g_stats_retired, 0, 2 * stats_size());
+}
+
+/* Appends the counts since the last dump to `fd`, one line per hook that
+   was called:
+
+       <pid> <hook> calls=<n> allowed=<n> denied=<n> ns=<bucket>:<n>,...
+
+   (ns=- if no call was checked). Each write() holds whole lines, so that
+   records of concurrent processes appending to the same file do not mix
+   within a line. */
+static void stats_dump(int fd, const char *const *names) {
+    stats_counter_t total;
+    stats_block_t *b;
+    char buf[4096];
+    size_t n = 0;
+    int i, k;
+    if (!g_stats_enabled) return;
+    pthread_mutex_lock(&g_stats_mutex);
+    for (i = 0; i != g_stats_hooks; ++i) {
+        char line[1024];
+        size_t m;
+        int sep = '=';
+        total = g_stats_retired[i];
+        for (b = g_stats_live; b; b = b->next) stats_add(&total, &b->c[i]);
+        if (total.calls == g_stats_dumped[i].calls) continue;
+        m = snprintf(line, sizeof(line), "%d %s calls=%llu allowed=%llu denied=%llu ns",
+                     (int)getpid(), names[i],
+                     (unsigned long long)(total.calls - g_stats_dumped[i].calls),
+                     (unsigned long long)(total.allowed - g_stats_dumped[i].allowed),
+                     (unsigned long long)(total.denied - g_stats_dumped[i].denied));
+        for (k = 0; k != STATS_BUCKETS; ++k) {
+            uint64_t count = total.ns[k] - g_stats_dumped[i].ns[k];
+            if (count == 0) continue;
+            m += snprintf(line + m, sizeof(line) - m, "%c%d:%llu", sep, k, (unsigned long long)count);
+            sep = ',';
+        }
+        m += snprintf(line + m, sizeof(line) - m, "%s\n", sep == '=' ? "=-" : "");
+        if (n + m > sizeof(buf)) {
+            if (write(fd, buf, n) == -1) break;
+            n = 0;
+        }
+        memcpy(buf + n, line, m);
+        n += m;
+        g_stats_dumped[i] = total;
+    }
+    if (n && write(fd, buf, n) != (ssize_t)n) {
+        /* the counts are lost; there is nobody to tell */
+    }
+    pthread_mutex_unlock(&g_stats_mutex);
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef _f3a9c61e_27d4_4b80_9e15_d84b0c7a2e53
+#define _f3a9c61e_27d4_4b80_9e15_d84b0c7a2e53
+
+/*
+   Compiles a whitelist index into a Landlock ruleset and applies it to
+   the calling process (and, irrevocably, all its descendants), so that
+   the kernel enforces the whitelist also for direct system calls and
+   static binaries.
+
+   Only reading and executing is restricted (LANDLOCK_READ_ACCESS);
+   writing and creating files stay under the control of the hooks. Each
+   "/path/<star><star>" entry becomes a rule granting read access beneath
+   /path; each exact entry becomes a rule for that file only, or, for a
+   directory, a rule allowing to list it (and, since Landlock rules always
+   apply to whole hierarchies, its subdirectories). A pattern entry
+   becomes a rule granting read access beneath the directory before its
+   first wildcard. An entry that does not exist (yet) becomes a rule
+   granting read access beneath its parent directory, so that the file
+   can still be read once it is created; if the parent does not exist
+   either, the entry is skipped (and reported), since a rule further up
+   could open up a whole tree.
+
+   Landlock rules are attached to inodes, so unlike the hooks they follow
+   symlinks, and denied accesses fail with EACCES rather than ENOENT.
+
+   The raw system calls are used throughout so that nothing here goes
+   through the hooks.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/landlock.h>
+
+#include "wlindex.h"
+
+#define LANDLOCK_FILE_ACCESS (LANDLOCK_ACCESS_FS_EXECUTE | LANDLOCK_ACCESS_FS_READ_FILE)
+#define LANDLOCK_READ_ACCESS (LANDLOCK_FILE_ACCESS | LANDLOCK_ACCESS_FS_READ_DIR)
+
+typedef struct {
+    int ruleset_fd;
+    int widened; /* entries for which the rules are wider */
+    const char *header; /* for reporting skipped entries */
+} landlock_ctx_t;
+
+/* Returns the Landlock ABI version supported by the kernel, or 0 */
+static inline int landlock_abi(void) {
+    long abi = syscall(SYS_landlock_create_ruleset, NULL, 0, LANDLOCK_CREATE_RULESET_VERSION);
+    return abi < 0 ? 0 : (int)abi;
+}
+
+/* Adds a rule for `path`; `beneath` is set for prefix entries. A path
+   that does not exist is covered through its parent directory. Returns
+   0 if the rule was added or the path was skipped. */
+static inline int landlock_add_path(landlock_ctx_t *c, const char *path, int beneath) {
+    struct landlock_path_beneath_attr attr;
+    struct stat st;
+    char parent[PATH_MAX];
+    int fd = syscall(SYS_openat, AT_FDCWD, path, O_PATH | O_CLOEXEC);
+    int missing = 0, r;
+    if (fd == -1) {
+        size_t n = strlen(path);
+        if (errno != ENOENT || path[0] != '/' || n >= sizeof(parent)) return 0;
+        memcpy(parent, path, n + 1);
+        while (n > 1 && parent[n - 1] == '/') --n;
+        while (n > 1 && parent[n - 1] != '/') --n;
+        if (n > 1) --n; /* drop the trailing slash, but keep "/" */
+        parent[n] = 0;
+        fd = syscall(SYS_openat, AT_FDCWD, parent, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "%sLandlock: not covering %s, which does not exist, "
+                    "nor does its directory\n", c->header, path);
+            return 0;
+        }
+        missing = 1;
+    }
+    if (fstat(fd, &st) != 0) {
+        syscall(SYS_close, fd);
+        return 0;
+    }
+    if (missing) {
+        attr.allowed_access = LANDLOCK_READ_ACCESS;
+        c->widened++;
+    } else if (!S_ISDIR(st.st_mode)) {
+        attr.allowed_access = LANDLOCK_FILE_ACCESS;
+    } else if (beneath) {
+        attr.allowed_access = LANDLOCK_READ_ACCESS;
+    } else {
+        attr.allowed_access = LANDLOCK_ACCESS_FS_READ_DIR;
+        c->widened++;
+    }
+    attr.parent_fd = fd;
+    r = syscall(SYS_landlock_add_rule, c->ruleset_fd, LANDLOCK_RULE_PATH_BENEATH, &attr, 0);
+    syscall(SYS_close, fd);
+    return r;
+}
+
+static inline int landlock_add_entry(const char *path, uint32_t flags, void *ctx) {
+    landlock_ctx_t *c = ctx;
+    if (flags & WL_PATTERN) {
+        char dir[PATH_MAX];
+        size_t n = strcspn(path, "*?[\\");
+        while (n > 1 && path[n - 1] != '/') --n;
+        if (n > 1) --n; /* drop the trailing slash, but keep "/" */
+        if (n >= sizeof(dir)) return 0;
+        memcpy(dir, path, n);
+        dir[n] = 0;
+        c->widened++;
+        return landlock_add_path(c, dir, 1) != 0 ? -1 : 0;
+    }
+    return landlock_add_path(c, path, (flags & WL_PREFIX) != 0) != 0 ? -1 : 0;
+}
+
+/* Restricts the process to reading and executing what `idx` whitelists,
+   plus the files in the NULL-terminated list `extra` (e.g., the
+   whitelist file itself, which descendants need to read); skipped
+   entries are reported to stderr, prefixed with `header`. Sets
+   *widened to the number of exact directory, pattern and missing
+   entries, for which the ruleset is wider than the whitelist. Returns 0 on success, or -1 with
+   errno set if Landlock is unavailable or the ruleset could not be
+   applied; in that case the process is left unrestricted. */
+static inline int landlock_restrict(const wlindex_t *idx, const char *const *extra,
+                                    const char *header, int *widened) {
+    struct landlock_ruleset_attr attr;
+    landlock_ctx_t c;
+    int saved_errno;
+    if (landlock_abi() < 1) {
+        errno = ENOSYS;
+        return -1;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.handled_access_fs = LANDLOCK_READ_ACCESS;
+    c.ruleset_fd = syscall(SYS_landlock_create_ruleset, &attr, sizeof(attr), 0);
+    c.widened = 0;
+    c.header = header;
+    if (c.ruleset_fd == -1) return -1;
+    if (wlindex_foreach(idx, landlock_add_entry, &c) != 0) goto fail;
+    for (; *extra; ++extra) {
+        if (landlock_add_path(&c, *extra, 0) != 0) goto fail;
+    }
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) goto fail;
+    if (syscall(SYS_landlock_restrict_self, c.ruleset_fd, 0) != 0) goto fail;
+    syscall(SYS_close, c.ruleset_fd);
+    *widened = c.widened;
+    return 0;
+ fail:
+    saved_errno = errno;
+    syscall(SYS_close, c.ruleset_fd);
+    errno = saved_errno;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef _7c2e95b4_d1a3_4f68_8e07_5b9a4c31f2d6
+#define _7c2e95b4_d1a3_4f68_8e07_5b9a4c31f2d6
+
+/*
+   Binary log format (HDIST_JAIL_LOG_FORMAT=binary).
+
+   The log is a plain sequence of records in native byte order, each
+   starting with a logfmt_record_t header whose `size` covers the whole
+   record. If the LOGFMT_TIMESTAMP flag is set, the header is followed by
+   a 64-bit CLOCK_MONOTONIC timestamp in nanoseconds. The rest of the
+   record is the payload, without terminator:
+
+   LOGFMT_ENTRY:  an access to the path given as payload by `pid`, with
+                  action `action`
+   LOGFMT_ACTION: defines the name (payload) of action id `action`
+   LOGFMT_CWD:    the working directory (payload) of `pid` from here on;
+                  only in traces (HDIST_JAIL_RECORD), where entries are
+                  all checked paths as given, and relative ones are
+                  relative to it
+
+   Actions are interned: a process writes the definition of an action id
+   before its first entry using it, and no thread of the process writes
+   such an entry before that write has completed, so a reader always sees
+   the definition first. All processes of one build of the jail use
+   the same ids.
+
+   Records are never larger than PIPE_BUF, so that, as with the text
+   format, writes from different processes appending to the same file do
+   not interleave. Paths that do not fit are truncated, and the record is
+   flagged with LOGFMT_TRUNCATED.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+enum {
+    LOGFMT_ENTRY = 1,
+    LOGFMT_ACTION = 2,
+    LOGFMT_CWD = 3
+};
+#define LOGFMT_TYPE_MASK 0x0f
+#define LOGFMT_TIMESTAMP 0x10
+#define LOGFMT_TRUNCATED 0x20
+#define LOGFMT_MAX_RECORD PIPE_BUF
+
+typedef struct {
+    uint16_t size;
+    uint8_t type; /* LOGFMT_ENTRY, LOGFMT_ACTION or LOGFMT_CWD, plus flags */
+    uint8_t action;
+    uint32_t pid;
+} logfmt_record_t;
+
+/* Encodes a record into `buf`, which has room for `room` bytes (at least
+   sizeof(logfmt_record_t) + sizeof(uint64_t)); `timestamp` may be NULL.
+   Returns the size of the record. */
+static inline size_t logfmt_encode(char *buf, size_t room, int type, int action,
+                                   uint32_t pid, const uint64_t *timestamp,
+                                   const char *data, size_t len) {
+    logfmt_record_t rec;
+    size_t off = sizeof(rec);
+    if (room > LOGFMT_MAX_RECORD) room = LOGFMT_MAX_RECORD;
+    rec.type = type;
+    rec.action = action;
+    rec.pid = pid;
+    if (timestamp) {
+        rec.type |= LOGFMT_TIMESTAMP;
+        memcpy(buf + off, timestamp, sizeof(*timestamp));
+        off += sizeof(*timestamp);
+    }
+    if (len > room - off) {
+        len = room - off;
+        rec.type |= LOGFMT_TRUNCATED;
+    }
+    memcpy(buf + off, data, len);
+    rec.size = off + len;
+    memcpy(buf, &rec, sizeof(rec));
+    return rec.size;
+}
+
+/* Decodes the record at the start of `buf` (of `n` bytes available).
+   Returns its size, 0 if the record is incomplete, or -1 if the data is
+   not a valid record. */
+static inline int logfmt_decode(const char *buf, size_t n, logfmt_record_t *rec,
+                                uint64_t *timestamp, const char **data, size_t *len) {
+    size_t off = sizeof(*rec);
+    int type;
+    if (n < sizeof(*rec)) return 0;
+    memcpy(rec, buf, sizeof(*rec));
+    type = rec->type & LOGFMT_TYPE_MASK;
+    if ((type != LOGFMT_ENTRY && type != LOGFMT_ACTION && type != LOGFMT_CWD) ||
+        rec->size < sizeof(*rec) || rec->size > LOGFMT_MAX_RECORD) return -1;
+    if (rec->type & LOGFMT_TIMESTAMP) {
+        if (rec->size < off + sizeof(*timestamp)) return -1;
+        if (n >= off + sizeof(*timestamp)) memcpy(timestamp, buf + off, sizeof(*timestamp));
+        off += sizeof(*timestamp);
+    } else {
+        *timestamp = 0;
+    }
+    if (n < rec->size) return 0;
+    *data = buf + off;
+    *len = rec->size - off;
+    return rec->size;
+}
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef _5f9d2c71_0b3e_4a86_b7c4_e18a6d42f093
+#define _5f9d2c71_0b3e_4a86_b7c4_e18a6d42f093
+
+/*
+   Shared-memory log ring.
+
+   hdistjail-collect creates a ring in a memfd and passes it to the whole
+   process tree through HDIST_JAIL_LOG_RING; every jailed process maps it
+   and pushes log records into it, while the collector drains it to disk.
+   This replaces one write() to a shared O_APPEND file per entry with a
+   memcpy and an atomic increment.
+
+   The ring is a bounded multi-producer queue of fixed-size slots (after
+   Vyukov). Each slot starts with a sequence word: the slot is free for
+   position `pos` when seq == pos, being filled by the producer of `pos`
+   when seq == pos | LOGRING_CLAIMED, and holds the data for `pos` when
+   seq == pos + 1. A record of k slots is reserved with one fetch-and-add
+   on `head`; the producer claims each of its slots with a compare-and-
+   swap (noting its pid in the slot), fills it, and publishes it with
+   another. The collector consumes records in order from `tail` and
+   frees slots by setting seq to the position they will have on the next
+   lap.
+
+   A record is a logring_record_t header followed by the action name and
+   the path, continued over as many slots as needed.
+
+   A producer that dies between reserving and publishing would block the
+   tail forever. So when the tail has not moved for LOGRING_ABANDON_NS
+   (shorter than producers wait for a full ring),
+   the collector abandons the record there (logring_abandon()): slots
+   that were not claimed, or whose producer is dead, are freed for the
+   next lap unused, and the rest of the record is discarded as its slots
+   come in. A producer that finds one of its slots abandoned (its claim
+   or publication fails) drops the record. A slot claimed by a live
+   producer is never taken away from it.
+
+   If the ring stays full, producers wait, but at most LOGRING_WAIT_NS
+   per slot and only while the collector is alive (checked through
+   collector_pid); after that, logging to the ring is given up and the
+   caller falls back to its log file rather than hanging the process.
+   Records that are abandoned, or that can never fit, are counted in
+   `dropped`.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <limits.h>
+#include <sys/types.h>
+
+#define LOGRING_MAGIC "HDJAILRG"
+#define LOGRING_MAGIC_SIZE 8
+#define LOGRING_VERSION 2
+#define LOGRING_SLOT_SIZE 256
+#define LOGRING_SLOT_DATA (LOGRING_SLOT_SIZE - 2 * sizeof(uint64_t))
+#define LOGRING_CLAIMED ((uint64_t)1 << 63)
+#define LOGRING_ABANDON_NS 500000000ULL
+#define LOGRING_WAIT_NS 2000000000ULL
+
+typedef struct {
+    char magic[LOGRING_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t n_slots; /* power of two */
+    int32_t collector_pid;
+    char pad0[44];
+    uint64_t head; /* next position to reserve */
+    char pad1[56];
+    uint64_t tail; /* next position to consume */
+    char pad2[56];
+    uint64_t dropped; /* records abandoned or too large */
+    char pad3[56];
+} logring_header_t;
+
+typedef struct {
+    uint64_t seq;
+    int32_t owner; /* pid of the producer that last claimed the slot */
+    char pad[4];
+    char data[LOGRING_SLOT_DATA];
+} logring_slot_t;
+
+typedef struct {
+    uint32_t pid;
+    uint16_t path_len;
+    uint8_t action_len;
+    uint8_t n_slots;
+} logring_record_t;
+
+typedef struct {
+    logring_header_t *header;
+    logring_slot_t *slots;
+    uint64_t mask;
+    uint64_t discard_until; /* collector side: end of an abandoned record */
+} logring_t;
+
+static inline size_t logring_size(uint32_t n_slots) {
+    return sizeof(logring_header_t) + (size_t)n_slots * sizeof(logring_slot_t);
+}
+
+/* Initializes a freshly created ring in `buf` (collector side) */
+static inline void logring_init(void *buf, uint32_t n_slots, pid_t collector_pid) {
+    logring_header_t *h = buf;
+    logring_slot_t *slots = (logring_slot_t*)(h + 1);
+    uint32_t i;
+    memset(h, 0, sizeof(logring_header_t));
+    memcpy(h->magic, LOGRING_MAGIC, LOGRING_MAGIC_SIZE);
+    h->version = LOGRING_VERSION;
+    h->n_slots = n_slots;
+    h->collector_pid = collector_pid;
+    for (i = 0; i != n_slots; ++i) slots[i].seq = i;
+}
+
+/* Sets up `r` to refer to a mapped ring; returns -1 if it is not valid */
+static inline int logring_open(logring_t *r, void *buf, size_t size) {
+    logring_header_t *h = buf;
+    if (size < sizeof(logring_header_t)) return -1;
+    if (memcmp(h->magic, LOGRING_MAGIC, LOGRING_MAGIC_SIZE) != 0) return -1;
+    if (h->version != LOGRING_VERSION) return -1;
+    if (h->n_slots == 0 || (h->n_slots & (h->n_slots - 1)) != 0) return -1;
+    if (size < logring_size(h->n_slots)) return -1;
+    r->header = h;
+    r->slots = (logring_slot_t*)(h + 1);
+    r->mask = h->n_slots - 1;
+    r->discard_until = 0;
+    return 0;
+}
+
+static inline uint64_t logring_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Waits until slot `pos` is free and claims it for `pid`. Spins briefly,
+   then sleeps and checks that the collector is still alive. Returns 0
+   once claimed, 1 if the collector abandoned the position, and -1 if
+   the collector is gone or the slot did not become free in time. */
+static inline int logring_claim(logring_t *r, uint64_t pos, uint32_t pid) {
+    logring_slot_t *slot = &r->slots[pos & r->mask];
+    uint64_t deadline = 0;
+    int i;
+    for (i = 0; ; ++i) {
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos && __atomic_compare_exchange_n(&slot->seq, &seq, pos | LOGRING_CLAIMED, 0,
+                                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&slot->owner, (int32_t)pid, __ATOMIC_RELAXED);
+            return 0;
+        }
+        if ((seq & ~LOGRING_CLAIMED) > pos) return 1;
+        if (i < 100) {
+            sched_yield();
+        } else {
+            struct timespec ts = {0, 1000000};
+            if (i == 100) deadline = logring_now() + LOGRING_WAIT_NS;
+            if (i % 100 == 0 && ((kill(r->header->collector_pid, 0) == -1 && errno == ESRCH) ||
+                                 logring_now() > deadline)) {
+                return -1;
+            }
+            nanosleep(&ts, NULL);
+        }
+    }
+}
+
+/* Pushes one record. Returns -1 if the collector has gone away or the
+   ring stayed full, in which case the caller should stop using the ring;
+   a record that was abandoned or can not fit is dropped, returning 0. */
+static inline int logring_push(logring_t *r, uint32_t pid, const char *action, const char *path) {
+    logring_record_t rec;
+    size_t action_len = strlen(action), path_len = strlen(path);
+    size_t total, done, i;
+    const char *parts[3];
+    size_t part_lens[3];
+    int part = 0;
+    uint64_t pos;
+
+    if (action_len > 255) action_len = 255;
+    if (path_len > PATH_MAX) path_len = PATH_MAX;
+    total = sizeof(rec) + action_len + path_len;
+    rec.pid = pid;
+    rec.path_len = path_len;
+    rec.action_len = action_len;
+    rec.n_slots = (total + LOGRING_SLOT_DATA - 1) / LOGRING_SLOT_DATA;
+    if (rec.n_slots > r->header->n_slots) {
+        /* can not possibly fit */
+        __atomic_fetch_add(&r->header->dropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    pos = __atomic_fetch_add(&r->header->head, rec.n_slots, __ATOMIC_RELAXED);
+    parts[0] = (const char*)&rec; part_lens[0] = sizeof(rec);
+    parts[1] = action; part_lens[1] = action_len;
+    parts[2] = path; part_lens[2] = path_len;
+    done = 0;
+    for (i = 0; i != rec.n_slots; ++i) {
+        logring_slot_t *slot = &r->slots[(pos + i) & r->mask];
+        uint64_t claimed = (pos + i) | LOGRING_CLAIMED;
+        size_t fill = 0;
+        int claim = logring_claim(r, pos + i, pid);
+        if (claim != 0) return claim == 1 ? 0 : -1;
+        while (fill != LOGRING_SLOT_DATA && part != 3) {
+            size_t n = part_lens[part] - done;
+            if (n > LOGRING_SLOT_DATA - fill) n = LOGRING_SLOT_DATA - fill;
+            memcpy(slot->data + fill, parts[part] + done, n);
+            fill += n;
+            done += n;
+            if (done == part_lens[part]) {
+                part++;
+                done = 0;
+            }
+        }
+        if (!__atomic_compare_exchange_n(&slot->seq, &claimed, pos + i + 1, 0,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return 0; /* abandoned meanwhile */
+        }
+    }
+    return 0;
+}
+
+/* Collector side: frees position `pos` (at or after the tail) for the
+   next lap without consuming it, unless a live producer has claimed it,
+   it changes meanwhile, or it was published and `published` is not set.
+   Returns 1 if the slot was freed. */
+static inline int logring_free_slot(logring_t *r, uint64_t pos, int published) {
+    logring_slot_t *slot = &r->slots[pos & r->mask];
+    uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == (pos | LOGRING_CLAIMED)) {
+        int32_t owner = __atomic_load_n(&slot->owner, __ATOMIC_RELAXED);
+        if (owner != 0 && !(kill(owner, 0) == -1 && errno == ESRCH)) return 0;
+    } else if (seq != pos && !(published && seq == pos + 1)) {
+        return 0;
+    }
+    return __atomic_compare_exchange_n(&slot->seq, &seq, pos + r->header->n_slots, 0,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/* Collector side: abandons the record at the tail, which has not been
+   completed for too long. If its first slot was published, the length
+   is known and the rest is discarded by logring_pop() as it comes in;
+   otherwise the first slot and the reserved slots after it that were
+   never claimed or whose producer is dead (the remainder of the record, or records of producers
+   that have only just reserved theirs) are freed. */
+static inline void logring_abandon(logring_t *r) {
+    uint64_t tail = r->header->tail, pos = tail;
+    uint64_t head = __atomic_load_n(&r->header->head, __ATOMIC_ACQUIRE);
+    logring_slot_t *first = &r->slots[tail & r->mask];
+    if (head == tail || r->discard_until > tail) return;
+    if (__atomic_load_n(&first->seq, __ATOMIC_ACQUIRE) == tail + 1) {
+        logring_record_t rec;
+        memcpy(&rec, first->data, sizeof(rec));
+        r->discard_until = tail + (rec.n_slots ? rec.n_slots : 1);
+        __atomic_fetch_add(&r->header->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (!logring_free_slot(r, pos, 0)) return;
+    __atomic_fetch_add(&r->header->dropped, 1, __ATOMIC_RELAXED);
+    for (++pos; pos != head && logring_free_slot(r, pos, 0); ++pos);
+    __atomic_store_n(&r->header->tail, pos, __ATOMIC_RELEASE);
+}
+
+/* Collector side: if a complete record is available at the tail, copies
+   it out (action and path NUL-terminated; `action` must have room for 256
+   bytes and `path` for PATH_MAX + 1), frees its slots and returns 1; otherwise
+   returns 0. */
+static inline int logring_pop(logring_t *r, logring_record_t *rec, char *action, char *path) {
+    uint64_t tail = r->header->tail, i;
+    logring_slot_t *first;
+    size_t done = 0;
+    /* the remainder of an abandoned record */
+    for (; r->discard_until > tail; ++tail) {
+        if (!logring_free_slot(r, tail, 1)) return 0;
+        __atomic_store_n(&r->header->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    first = &r->slots[tail & r->mask];
+    if (__atomic_load_n(&first->seq, __ATOMIC_ACQUIRE) != tail + 1) return 0;
+    memcpy(rec, first->data, sizeof(*rec));
+    for (i = 1; i < rec->n_slots; ++i) {
+        if (__atomic_load_n(&r->slots[(tail + i) & r->mask].seq, __ATOMIC_ACQUIRE) != tail + i + 1) {
+            return 0;
+        }
+    }
+    for (i = 0; i != rec->n_slots; ++i) {
+        logring_slot_t *slot = &r->slots[(tail + i) & r->mask];
+        size_t off = (i == 0) ? sizeof(*rec) : 0;
+        for (; off != LOGRING_SLOT_DATA && done != (size_t)rec->action_len + rec->path_len;
+             ++off, ++done) {
+            if (done < rec->action_len) action[done] = slot->data[off];
+            else path[done - rec->action_len] = slot->data[off];
+        }
+        __atomic_store_n(&slot->seq, tail + i + r->header->n_slots, __ATOMIC_RELEASE);
+    }
+    action[rec->action_len] = 0;
+    path[rec->path_len] = 0;
+    __atomic_store_n(&r->header->tail, tail + rec->n_slots, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef _2f6b9d14_c803_4e57_a1b6_7d3e05f8c912
+#define _2f6b9d14_c803_4e57_a1b6_7d3e05f8c912
+
+/*
+   PATH index: which directories in $PATH contain a given file name, so
+   that execvp() of a bare command name is resolved with one hash lookup
+   instead of trying every PATH entry in turn.
+
+   The index holds the names in all PATH directories at once (built by
+   reading them, skipping subdirectories), each with a bit mask of the
+   PATH entries it was found in. It is keyed on the PATH string and
+   validated against the mtimes of the directories: they are compared
+   whenever a name is not found (it may have just been created) and
+   otherwise at most every PATHCACHE_RECHECK_NS, so that a command
+   installed in an earlier PATH entry than one already known shadows it
+   after at most that long. PATHs with more than PATHCACHE_MAX_DIRS
+   entries or with relative entries (including empty ones, which mean the
+   working directory) are not indexed, nor are PATH directories too large
+   for the fixed-size table; the caller then searches itself.
+
+   Commands are mostly exec-ed by a forked child, whose memory is gone
+   once it execs. So the index lives in one MAP_SHARED anonymous mapping
+   that is created in the parent before it first forks with an indexable
+   PATH (see pathcache_prepare_fork()) and is shared by the whole tree of
+   processes forked from it, up to their exec. The mapping takes about
+   500 KB of address space, but its pages are only allocated once a
+   child searches PATH. It is protected by a sequence lock:
+   readers never block and fall back to searching while it is being
+   written, and a writer that died in the middle (the lock is odd for
+   more than PATHCACHE_STALE_NS) is taken over.
+
+   The raw system calls are used so that nothing here goes through the
+   hooks.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "vcache.h"
+
+#define PATHCACHE_MAX_DIRS 64
+#define PATHCACHE_PATH_MAX 4096
+#define PATHCACHE_SLOTS 16384 /* power of two, at most half used */
+#define PATHCACHE_NAMES_SIZE (256 * 1024)
+#define PATHCACHE_RECHECK_NS 1000000000ULL
+#define PATHCACHE_STALE_NS 1000000000ULL
+
+enum { PATHCACHE_EMPTY = 0, PATHCACHE_READY, PATHCACHE_OVERFLOW };
+
+typedef struct {
+    uint32_t name; /* offset in names + 1; 0 if unused */
+    uint32_t len;
+    uint64_t dirs;
+} pathcache_slot_t;
+
+typedef struct {
+    int64_t sec, nsec; /* sec == -1 if missing */
+} pathcache_mtime_t;
+
+typedef struct {
+    uint32_t seq;
+    uint32_t state;
+    uint64_t write_ns; /* when the current writer took the lock */
+    uint64_t checked_ns; /* when the mtimes were last compared */
+    uint32_t n_dirs, n_names, names_size, path_len;
+    char path[PATHCACHE_PATH_MAX];
+    pathcache_mtime_t mtimes[PATHCACHE_MAX_DIRS];
+    pathcache_slot_t slots[PATHCACHE_SLOTS];
+    char names[PATHCACHE_NAMES_SIZE];
+} pathcache_t;
+
+static pathcache_t *g_pathcache = NULL;
+
+static inline uint64_t pathcache_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Maps the index if it is not yet */
+static pathcache_t *pathcache_map(void) {
+    pathcache_t *c = __atomic_load_n(&g_pathcache, __ATOMIC_ACQUIRE), *expected = NULL;
+    if (c) return c;
+    c = mmap(NULL, sizeof(pathcache_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (c == MAP_FAILED) return NULL;
+    if (!__atomic_compare_exchange_n(&g_pathcache, &expected, c, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(c, sizeof(pathcache_t));
+        return expected;
+    }
+    return c;
+}
+
+/* Only PATHs whose entries are all absolute are indexed */
+static inline int pathcache_indexable(const char *path_var, size_t len) {
+    const char *p = path_var;
+    int n = 0;
+    if (len == 0 || len >= PATHCACHE_PATH_MAX) return 0;
+    while (1) {
+        if (*p != '/' || ++n > PATHCACHE_MAX_DIRS) return 0;
+        p = strchrnul(p, ':');
+        if (!*p) return 1;
+        ++p;
+    }
+}
+
+/* Called before fork(), so that the children's execvp() fill the index
+   for their parent and siblings; a process without an indexable PATH
+   maps nothing */
+static inline void pathcache_prepare_fork(void) {
+    const char *path_var;
+    if (__atomic_load_n(&g_pathcache, __ATOMIC_ACQUIRE)) return;
+    path_var = getenv("PATH");
+    if (path_var && pathcache_indexable(path_var, strlen(path_var))) pathcache_map();
+}
+
+static inline uint32_t pathcache_slot(const char *name, size_t len) {
+    return (uint32_t)vcache_hash(name, len) & (PATHCACHE_SLOTS - 1);
+}
+
+/* Returns the mask of directories containing name, or 0; the result is
+   only meaningful if the sequence lock did not change meanwhile */
+static inline uint64_t pathcache_find(const pathcache_t *c, const char *name, size_t len) {
+    uint32_t i = pathcache_slot(name, len), probes;
+    for (probes = 0; probes != PATHCACHE_SLOTS; ++probes, i = (i + 1) & (PATHCACHE_SLOTS - 1)) {
+        const pathcache_slot_t *s = &c->slots[i];
+        uint32_t off = s->name;
+        if (off == 0) return 0;
+        if (s->len == len && off - 1 <= PATHCACHE_NAMES_SIZE - len &&
+            memcmp(c->names + off - 1, name, len) == 0) return s->dirs;
+    }
+    return 0;
+}
+
+static int pathcache_insert(pathcache_t *c, const char *name, size_t len, int dir) {
+    uint32_t i = pathcache_slot(name, len);
+    while (c->slots[i].name != 0) {
+        pathcache_slot_t *s = &c->slots[i];
+        if (s->len == len && memcmp(c->names + s->name - 1, name, len) == 0) {
+            s->dirs |= 1ULL << dir;
+            return 0;
+        }
+        i = (i + 1) & (PATHCACHE_SLOTS - 1);
+    }
+    if (c->n_names == PATHCACHE_SLOTS / 2 || c->names_size + len > PATHCACHE_NAMES_SIZE) return -1;
+    memcpy(c->names + c->names_size, name, len);
+    c->slots[i].name = c->names_size + 1;
+    c->slots[i].len = len;
+    c->slots[i].dirs = 1ULL << dir;
+    c->names_size += len;
+    c->n_names++;
+    return 0;
+}
+
+/* Opens the i-th directory of c->path with `flags`; returns the fd or -1 */
+static int pathcache_open_dir(const pathcache_t *c, int i, int flags) {
+    char dir[PATHCACHE_PATH_MAX];
+    const char *p = c->path, *end;
+    while (i--) p = strchr(p, ':') + 1;
+    end = strchrnul(p, ':');
+    memcpy(dir, p, end - p);
+    dir[end - p] = 0;
+    return syscall(SYS_openat, AT_FDCWD, dir, flags | O_DIRECTORY | O_CLOEXEC);
+}
+
+static void pathcache_mtime(int fd, pathcache_mtime_t *m) {
+    struct stat st;
+    m->sec = -1;
+    m->nsec = 0;
+    if (fd == -1 || fstat(fd, &st) != 0) return;
+    m->sec = st.st_mtim.tv_sec;
+    m->nsec = st.st_mtim.tv_nsec;
+}
+
+/* Returns 1 if no directory changed since the index was built */
+static int pathcache_unchanged(const pathcache_t *c) {
+    uint32_t i;
+    for (i = 0; i != c->n_dirs; ++i) {
+        pathcache_mtime_t m;
+        int fd = pathcache_open_dir(c, i, O_PATH);
+        pathcache_mtime(fd, &m);
+        if (fd != -1) syscall(SYS_close, fd);
+        if (m.sec != c->mtimes[i].sec || m.nsec != c->mtimes[i].nsec) return 0;
+    }
+    return 1;
+}
+
+static void pathcache_fill(pathcache_t *c) {
+    char buf[8192];
+    uint32_t i;
+    memset(c->slots, 0, sizeof(c->slots));
+    c->n_names = c->names_size = 0;
+    c->state = PATHCACHE_READY;
+    for (i = 0; i != c->n_dirs; ++i) {
+        int fd = pathcache_open_dir(c, i, O_RDONLY);
+        long n;
+        pathcache_mtime(fd, &c->mtimes[i]);
+        if (fd == -1) continue;
+        while (c->state == PATHCACHE_READY &&
+               (n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+            long off = 0;
+            while (off < n) {
+                struct dirent64 *d = (struct dirent64*)(buf + off);
+                const char *name = d->d_name;
+                off += d->d_reclen;
+                if (d->d_type == DT_DIR || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                    continue;
+                }
+                if (pathcache_insert(c, name, strlen(name), i) != 0) {
+                    c->state = PATHCACHE_OVERFLOW;
+                    break;
+                }
+            }
+        }
+        syscall(SYS_close, fd);
+    }
+}
+
+/* Takes the write lock, returning the odd sequence number, or 0 if
+   another (live) writer holds it */
+static uint32_t pathcache_lock(pathcache_t *c, uint64_t now) {
+    uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED), locked;
+    if (seq & 1) {
+        if ((int64_t)(now - __atomic_load_n(&c->write_ns, __ATOMIC_RELAXED)) < (int64_t)PATHCACHE_STALE_NS) {
+            return 0;
+        }
+        locked = seq + 2;
+    } else {
+        locked = seq + 1;
+    }
+    if (!__atomic_compare_exchange_n(&c->seq, &seq, locked, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    __atomic_store_n(&c->write_ns, now, __ATOMIC_RELAXED);
+    return locked;
+}
+
+/* Brings the index up to date for path_var */
+static void pathcache_refresh(pathcache_t *c, const char *path_var, size_t len, uint64_t now) {
+    uint32_t seq = pathcache_lock(c, now);
+    if (!seq) return;
+    if (c->state == PATHCACHE_EMPTY || c->path_len != len || memcmp(c->path, path_var, len) != 0) {
+        const char *p;
+        memcpy(c->path, path_var, len);
+        c->path[len] = 0;
+        c->path_len = len;
+        for (c->n_dirs = 1, p = path_var; (p = strchr(p, ':')); ++p) c->n_dirs++;
+        pathcache_fill(c);
+    } else if (c->state == PATHCACHE_READY && !pathcache_unchanged(c)) {
+        pathcache_fill(c);
+    }
+    c->checked_ns = now;
+    __atomic_store_n(&c->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+enum { PATHCACHE_BUSY, PATHCACHE_HIT, PATHCACHE_ABSENT, PATHCACHE_STALE, PATHCACHE_UNUSABLE };
+
+static int pathcache_read(pathcache_t *c, const char *path_var, size_t path_len,
+                          const char *name, size_t name_len, uint64_t now, uint64_t *dirs) {
+    uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE), state;
+    int same_path, fresh;
+    if (seq & 1) return PATHCACHE_BUSY;
+    state = c->state;
+    same_path = c->path_len == path_len && memcmp(c->path, path_var, path_len) == 0;
+    fresh = (int64_t)(now - c->checked_ns) < (int64_t)PATHCACHE_RECHECK_NS;
+    *dirs = same_path && state == PATHCACHE_READY ? pathcache_find(c, name, name_len) : 0;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&c->seq, __ATOMIC_RELAXED) != seq) return PATHCACHE_BUSY;
+    if (!same_path || state == PATHCACHE_EMPTY) return PATHCACHE_STALE;
+    if (state == PATHCACHE_OVERFLOW) return PATHCACHE_UNUSABLE;
+    if (!fresh) return PATHCACHE_STALE;
+    return *dirs ? PATHCACHE_HIT : PATHCACHE_ABSENT;
+}
+
+/* Sets *dirs to the mask of the entries of path_var (bit i for the i-th
+   entry) that contain `name`, and returns 1; returns 0 if the index can
+   not tell, in which case all entries should be tried */
+static int pathcache_lookup(const char *path_var, const char *name, uint64_t *dirs) {
+    size_t path_len = strlen(path_var), name_len = strlen(name);
+    uint64_t now;
+    pathcache_t *c;
+    int r;
+    if (name_len > NAME_MAX || !pathcache_indexable(path_var, path_len) ||
+        !(c = pathcache_map())) return 0;
+    now = pathcache_now();
+    r = pathcache_read(c, path_var, path_len, name, name_len, now, dirs);
+    if (r == PATHCACHE_HIT) return 1;
+    if (r != PATHCACHE_STALE && r != PATHCACHE_ABSENT) return 0;
+    /* a missing name may have just been created */
+    pathcache_refresh(c, path_var, path_len, now);
+    r = pathcache_read(c, path_var, path_len, name, name_len, now, dirs);
+    return r == PATHCACHE_HIT || r == PATHCACHE_ABSENT;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef _a4d1e8c3_6f27_4b95_9c0a_3e7b52d8f164
+#define _a4d1e8c3_6f27_4b95_9c0a_3e7b52d8f164
+
+/*
+   Seen-set for log deduplication: a fixed-size, insert-only, lock-free
+   hash set of 64-bit fingerprints of (path, action) pairs. It lives either
+   in private memory (one set per process) or in a shared memfd (one set
+   for a whole process tree); in both cases the layout is the same and
+   inserting is a compare-and-swap on an empty slot, so it works across
+   threads and processes alike.
+
+   Fingerprint collisions would suppress a distinct entry; with 64-bit
+   fingerprints this is negligible for the number of distinct paths of
+   any build. If the set fills up, entries are reported as new, i.e.,
+   logging degrades to not deduplicating rather than losing entries.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#define SEENSET_MAGIC "HDJAILSS"
+#define SEENSET_MAGIC_SIZE 8
+#define SEENSET_VERSION 1
+#define SEENSET_MAX_PROBES 64
+
+typedef struct {
+    char magic[SEENSET_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t n_slots; /* power of two */
+} seenset_header_t;
+
+typedef struct {
+    seenset_header_t *header;
+    uint64_t *slots;
+    uint64_t mask;
+} seenset_t;
+
+static inline size_t seenset_size(uint32_t n_slots) {
+    return sizeof(seenset_header_t) + (size_t)n_slots * sizeof(uint64_t);
+}
+
+/* Initializes a freshly created (zeroed) set in `buf` */
+static inline void seenset_init(void *buf, uint32_t n_slots) {
+    seenset_header_t *h = buf;
+    memcpy(h->magic, SEENSET_MAGIC, SEENSET_MAGIC_SIZE);
+    h->version = SEENSET_VERSION;
+    h->n_slots = n_slots;
+}
+
+static inline int seenset_open(seenset_t *s, void *buf, size_t size) {
+    seenset_header_t *h = buf;
+    if (size < sizeof(seenset_header_t)) return -1;
+    if (memcmp(h->magic, SEENSET_MAGIC, SEENSET_MAGIC_SIZE) != 0) return -1;
+    if (h->version != SEENSET_VERSION) return -1;
+    if (h->n_slots == 0 || (h->n_slots & (h->n_slots - 1)) != 0) return -1;
+    if (size < seenset_size(h->n_slots)) return -1;
+    s->header = h;
+    s->slots = (uint64_t*)(h + 1);
+    s->mask = h->n_slots - 1;
+    return 0;
+}
+
+static inline uint64_t seenset_fingerprint(const char *path, const char *action) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *path; ++path) h = (h ^ (unsigned char)*path) * 1099511628211ULL;
+    h = (h ^ 0) * 1099511628211ULL;
+    for (; *action; ++action) h = (h ^ (unsigned char)*action) * 1099511628211ULL;
+    /* 0 marks empty slots */
+    return h ? h : 1;
+}
+
+/* Returns 1 if `fp` was not in the set before (or the set is full), 0 if
+   it had been seen already */
+static inline int seenset_insert(seenset_t *s, uint64_t fp) {
+    uint64_t i = fp & s->mask;
+    int probe;
+    for (probe = 0; probe != SEENSET_MAX_PROBES; ++probe, i = (i + 1) & s->mask) {
+        uint64_t cur = __atomic_load_n(&s->slots[i], __ATOMIC_RELAXED);
+        if (cur == fp) return 0;
+        if (cur == 0) {
+            if (__atomic_compare_exchange_n(&s->slots[i], &cur, fp, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                return 1;
+            }
+            if (cur == fp) return 0;
+        }
+    }
+    return 1;
+}
+
+#endif
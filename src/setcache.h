@@ -0,0 +1,107 @@
+#ifndef _5d2e8b19_c6a4_4f07_93e1_a8b07d4c6f21
+#define _5d2e8b19_c6a4_4f07_93e1_a8b07d4c6f21
+
+/*
+   A bounded, per-process map from a string key to a small value, for the
+   caches on the hot path of the hooks (vcache.h, dircache.h).
+   SETCACHE_INIT(name, sets, key_max, tag_t, value_t) defines the table
+   g_<name>, the counters g_<name>_hits and g_<name>_misses (only counted
+   while g_<name>_counting is set, to keep them off the hot path), and
+
+     int <name>_lookup(key, n, hash, tag, value_t *value)
+     void <name>_insert(key, n, hash, tag, const value_t *value)
+
+   where `hash` is the caller's hash of key[0:n] and `tag` a scalar that
+   must match for an entry to hit (e.g., the generation of whatever the
+   value was computed from). Keys longer than `key_max` are not cached.
+
+   The cache is 4-way set associative with not-recently-used replacement
+   within a set: a hit sets the referenced bit of the entry unless it is
+   set already, and an insertion takes a way whose bit is clear, clearing
+   the bits of the set when there is none. Hits on hot entries thus write
+   no shared memory. Each entry is protected by its own sequence lock, so
+   readers never block, and a writer that finds an entry busy simply
+   does not cache.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#define SETCACHE_WAYS 4
+
+#define SETCACHE_INIT(name, sets, key_max, tag_t, value_t)                  \
+    typedef struct {                                                        \
+        uint32_t seq;                                                       \
+        uint16_t len;                                                       \
+        uint8_t referenced;                                                 \
+        uint64_t hash;                                                      \
+        tag_t tag;                                                          \
+        value_t value;                                                      \
+        char key[key_max];                                                  \
+    } name##_entry_t;                                                       \
+                                                                            \
+    static name##_entry_t g_##name[sets][SETCACHE_WAYS];                    \
+    static int g_##name##_counting = 0;                                     \
+    static uint64_t g_##name##_hits = 0, g_##name##_misses = 0;             \
+                                                                            \
+    /* Returns 1 and sets *value on a hit, 0 on a miss */                   \
+    static inline int name##_lookup(const char *key, size_t n, uint64_t hash, \
+                                    tag_t tag, value_t *value) {            \
+        name##_entry_t *set = g_##name[hash & ((sets) - 1)];                \
+        int w;                                                              \
+        for (w = 0; w != SETCACHE_WAYS; ++w) {                              \
+            name##_entry_t *e = &set[w];                                    \
+            uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);      \
+            if ((seq & 1) || e->hash != hash || e->len != n || e->tag != tag) continue; \
+            if (memcmp(e->key, key, n) == 0) {                              \
+                value_t v = e->value;                                       \
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);                    \
+                if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq) break; \
+                /* the bit is only a hint, so relaxed accesses will do */   \
+                if (!__atomic_load_n(&e->referenced, __ATOMIC_RELAXED)) {   \
+                    __atomic_store_n(&e->referenced, 1, __ATOMIC_RELAXED);  \
+                }                                                           \
+                if (g_##name##_counting) {                                  \
+                    __atomic_fetch_add(&g_##name##_hits, 1, __ATOMIC_RELAXED); \
+                }                                                           \
+                *value = v;                                                 \
+                return 1;                                                   \
+            }                                                               \
+        }                                                                   \
+        if (g_##name##_counting) __atomic_fetch_add(&g_##name##_misses, 1, __ATOMIC_RELAXED); \
+        return 0;                                                           \
+    }                                                                       \
+                                                                            \
+    static inline void name##_insert(const char *key, size_t n, uint64_t hash, \
+                                     tag_t tag, const value_t *value) {     \
+        name##_entry_t *set = g_##name[hash & ((sets) - 1)], *e = NULL;     \
+        uint32_t seq;                                                       \
+        int w, first = (hash >> 32) & (SETCACHE_WAYS - 1);                  \
+        if (n > (key_max)) return;                                          \
+        /* replace a way that was not used since the bits were last        \
+           cleared, starting the search at a way chosen by the hash */      \
+        for (w = 0; w != SETCACHE_WAYS && !e; ++w) {                        \
+            name##_entry_t *way = &set[(first + w) & (SETCACHE_WAYS - 1)];  \
+            if (!__atomic_load_n(&way->referenced, __ATOMIC_RELAXED)) e = way; \
+        }                                                                   \
+        if (!e) {                                                           \
+            for (w = 0; w != SETCACHE_WAYS; ++w) {                          \
+                __atomic_store_n(&set[w].referenced, 0, __ATOMIC_RELAXED);  \
+            }                                                               \
+            e = &set[first];                                                \
+        }                                                                   \
+        seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);                   \
+        if ((seq & 1) || !__atomic_compare_exchange_n(&e->seq, &seq, seq + 1, 0, \
+                                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) { \
+            return;                                                         \
+        }                                                                   \
+        e->hash = hash;                                                     \
+        e->len = n;                                                         \
+        e->tag = tag;                                                       \
+        e->value = *value;                                                  \
+        memcpy(e->key, key, n);                                             \
+        __atomic_store_n(&e->referenced, 0, __ATOMIC_RELAXED);              \
+        __atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);               \
+    }
+
+#endif
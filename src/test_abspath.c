@@ -1,47 +1,234 @@
+/*
+   test_abspath: checks normpath() and abspath() against fixed cases, and
+   normpath() against the original (quadratic) implementation below on
+   random paths made from components that exercise the rules.
+
+   Usage: test_abspath [iterations [seed]]
+          test_abspath bench [iterations]
+
+   The bench mode prints the throughput of both implementations on a few
+   kinds of paths, one JSON object per line.
+*/
 #include "abspath.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+/* The original normpath(), which shifts the whole tail of the string left
+   for every component it drops. */
+static void normpath_ref(char *p) {
+    /* note: cannot use strcat, strcpy as buffers overlap */
+
+    /* we keep initial / out of it for absolute paths, then the rest is the same */
+    char *start;
+    if (p[0] == '/') p++;
+    start = p;
+
+    while (1) {
+        /* Strategy: Modify p in place (copying up from the rest of the string)
+           when applying rules. Only if no rules were applied do we search for
+           a new path component (i.e., loop is used as rail recursion).
+
+           Invariant: p[0] is at beginning of next path component (which may
+           be empty). */
+        if (p[0] == 0) {
+            break;
+        } else if (p[0] == '/') {
+            char *dst = p, *src = p + 1;
+            while ((*dst++ = *src++));
+        } else if (p[0] == '.' && p[1] == '/') {
+            char *dst = p, *src = p + 2;
+            while ((*dst++ = *src++));
+        } else if (p[0] == '.' && p[1] == 0) {
+            p[0] = 0; /* leaves trailing / to be stripped off later */
+        } else if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == 0)) {
+            char *rest = p + 2;
+            if (p != start) p -= 2;
+            while  (*p != '/' && p != start) --p;
+            if (*p == '/') ++p;
+            char *dst = p;
+            while ((*dst++ = *rest++));
+        } else {
+            /* skip ahead to start of next path component */
+            while (*p != 0 && *p != '/') p++;
+            if (*p == '/') p++;
+        }
+    }
+    /* remove trailing / */
+    if (p != start && p[-1] == '/') p[-1] = 0;
+}
+
+static int g_failures = 0;
+
+static void check(const char *s, const char *expected) {
+    char buf[PATH_MAX];
+    strcpy(buf, s);
+    normpath(buf);
+    if (strcmp(buf, expected) != 0) {
+        printf("normpath(\"%s\"): got \"%s\", expected \"%s\"\n", s, buf, expected);
+        g_failures++;
+    }
+}
+
+static void check_abspath(const char *s, const char *expected) {
+    char buf[PATH_MAX];
+    if (abspath(s, buf) != 0 || strcmp(buf, expected) != 0) {
+        printf("abspath(\"%s\"): got \"%s\", expected \"%s\"\n", s, buf, expected);
+        g_failures++;
+    }
+}
+
+static void fixed_cases(void) {
+    char cwd[PATH_MAX], expected[PATH_MAX + 8];
+    check("foo////bar//.//.././x", "foo/x");
+    check("foo////bar//.//.././x/", "foo/x");
+    check(".", "");
+    check("", "");
+    check("foo/.", "foo");
+    check("foo/bar/..", "foo");
+    check("foo/bar/../", "foo");
+    check("foo/bar/../..", "");
+    check("foo/bar/../../", "");
+    check("foo/.bar/..baz/.../x.", "foo/.bar/..baz/.../x.");
+    check("a/b/../../c/./d", "c/d");
+
+    check("/foo/.", "/foo");
+    check("/foo/bar/..", "/foo");
+    check("/foo/bar/../", "/foo");
+    check("/foo/bar/../..", "/");
+    check("/foo/bar/../../", "/");
+    check("/usr/lib/x86_64-linux-gnu/libc.so.6", "/usr/lib/x86_64-linux-gnu/libc.so.6");
+    check("/usr/lib/x86_64-linux-gnu//libc.so.6", "/usr/lib/x86_64-linux-gnu/libc.so.6");
+    check("/usr/lib/x86_64-linux-gnu/./libc.so.6", "/usr/lib/x86_64-linux-gnu/libc.so.6");
+    check("/usr/lib/x86_64-linux-gnu/../lib64/libc.so.6", "/usr/lib/lib64/libc.so.6");
+
+    check("..", "");
+    check("../../../../../../..", "");
+    check("../../../../../../../", "");
+    check("/../../../../../../..", "/");
+    check("/../../../../../../../", "/");
+    check("/..", "/");
+    check("/../", "/");
+    check("/", "/");
+    check("/.", "/");
+    check("/.///././././etc", "/etc");
+    check("/.///././.././etc", "/etc");
+    check("//", "/");
+    check("/./", "/");
+    check("///./", "/");
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL) return;
+    check_abspath("/foo/../bar", "/bar");
+    snprintf(expected, sizeof(expected), "%s/foo", strcmp(cwd, "/") == 0 ? "" : cwd);
+    check_abspath("foo/bar/..", expected);
+}
+
+static uint64_t g_rng;
+
+static uint32_t rnd(void) {
+    g_rng = g_rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    return g_rng >> 33;
+}
+
+static const char *const COMPONENTS[] = {
+    "", ".", "..", "...", "a", "bc", ".x", "..y", "z.", "z..", "long-component-name"
+};
+#define N_COMPONENTS (sizeof(COMPONENTS) / sizeof(COMPONENTS[0]))
+
+static void random_path(char *buf, size_t room) {
+    size_t n = 0, k = rnd() % 24;
+    if (rnd() % 2) buf[n++] = '/';
+    while (k--) {
+        const char *c = COMPONENTS[rnd() % N_COMPONENTS];
+        size_t len = strlen(c);
+        if (n + len + 2 >= room) break;
+        memcpy(buf + n, c, len);
+        n += len;
+        if (k || rnd() % 2) buf[n++] = '/';
+    }
+    buf[n] = 0;
+}
+
+static void differential(long iterations) {
+    char path[512], got[512], expected[512];
+    long i;
+    for (i = 0; i != iterations; ++i) {
+        random_path(path, sizeof(path));
+        strcpy(got, path);
+        strcpy(expected, path);
+        normpath(got);
+        normpath_ref(expected);
+        if (strcmp(got, expected) != 0) {
+            printf("normpath(\"%s\"): got \"%s\", expected \"%s\"\n", path, got, expected);
+            if (++g_failures == 10) return;
+        }
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_one(const char *kind, const char *impl, void (*f)(char *),
+                      const char *path, long iterations) {
+    char buf[PATH_MAX];
+    size_t n = strlen(path) + 1;
+    uint64_t start = now_ns(), ns;
+    long i;
+    for (i = 0; i != iterations; ++i) {
+        memcpy(buf, path, n);
+        f(buf);
+        __asm__ volatile("" : : "r"(buf) : "memory");
+    }
+    ns = now_ns() - start;
+    printf("{\"kind\": \"%s\", \"impl\": \"%s\", \"length\": %zu, \"iterations\": %ld, "
+           "\"ns_per_call\": %.1f, \"mb_per_sec\": %.1f}\n",
+           kind, impl, n - 1, iterations, (double)ns / iterations,
+           (double)(n - 1) * iterations * 1e3 / ns);
+}
 
-void test(char *s) {
-    char *abs_s = abspath(s);
-    char *norm_s = strdup(s);
-    normpath(norm_s);
-    printf("%-25s -> '%s'  '%s'\n", s, abs_s, norm_s);
-    free(abs_s);
-    free(norm_s);
+static void bench(long iterations) {
+    static char messy[PATH_MAX], dotted[PATH_MAX];
+    const char *clean = "/usr/lib/gcc/x86_64-linux-gnu/12/include/stddef.h";
+    const char *cmake = "/build/project/src/module/CMakeFiles/target.dir/../../../include/./a/b.h";
+    size_t n = 0;
+    /* a/b/../../ repeated: every '..' shifts the whole tail in the original */
+    while (n + 10 < sizeof(messy) / 2) {
+        memcpy(messy + n, "a/b/../../", 10);
+        n += 10;
+    }
+    strcpy(messy + n, "c");
+    for (n = 0; n + 3 < sizeof(dotted) / 2; n += 2) memcpy(dotted + n, "./", 2);
+    strcpy(dotted + n, "x");
+    bench_one("clean", "new", normpath, clean, iterations);
+    bench_one("clean", "ref", normpath_ref, clean, iterations);
+    bench_one("cmake", "new", normpath, cmake, iterations);
+    bench_one("cmake", "ref", normpath_ref, cmake, iterations);
+    bench_one("messy", "new", normpath, messy, iterations / 100);
+    bench_one("messy", "ref", normpath_ref, messy, iterations / 100);
+    bench_one("dotted", "new", normpath, dotted, iterations / 100);
+    bench_one("dotted", "ref", normpath_ref, dotted, iterations / 100);
 }
 
 int main(int argc, char *argv[]) {
-    printf("\n");
-    test("foo////bar//.//.././x");
-    test("foo////bar//.//.././x/");
-    test(".");
-    test("foo/.");
-    test("foo/bar/..");
-    test("foo/bar/../");
-    test("foo/bar/../..");
-    test("foo/bar/../../");
-
-    test("/foo/.");
-    test("/foo/bar/..");
-    test("/foo/bar/../");
-    test("/foo/bar/../..");
-    test("/foo/bar/../../");
-
-    test("..");
-    test("../../../../../../..");
-    test("../../../../../../../");
-    test("/../../../../../../..");
-    test("/../../../../../../../");
-    test("/..");
-    test("/../");
-    test("/");
-    test("/.");
-    test("/.///././././etc");
-    test("/.///././.././etc");
-    test("//");
-    test("/./");
-    test("///./");
+    long iterations;
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench(argc > 2 ? atol(argv[2]) : 1000000);
+        return 0;
+    }
+    iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    g_rng = argc > 2 ? strtoull(argv[2], NULL, 10) : (uint64_t)time(NULL);
+    printf("test_abspath: seed %llu\n", (unsigned long long)g_rng);
+    fixed_cases();
+    differential(iterations);
+    if (g_failures) {
+        printf("test_abspath: %d failures\n", g_failures);
+        return 1;
+    }
+    printf("test_abspath: OK\n");
     return 0;
 }
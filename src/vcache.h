@@ -0,0 +1,36 @@
+#ifndef _e3b0a6f2_41c8_4d7e_8a51_96d2f0c7b13a
+#define _e3b0a6f2_41c8_4d7e_8a51_96d2f0c7b13a
+
+/*
+   Verdict cache: a bounded, per-process map from the raw path argument of
+   a hooked call to whether it was whitelisted, so that repeated lookups
+   of the same path cost one hash of the argument and no canonicalization.
+
+   Since the verdict for a relative path depends on the working directory,
+   and any verdict depends on the whitelist, each entry is tagged with the
+   cwd generation (0 for absolute paths) and whitelist generation it was
+   computed in (see vcache_tag()); an entry only hits if both still
+   match. The layout, replacement and locking are those of setcache.h.
+*/
+
+#include <stdint.h>
+
+#include "setcache.h"
+
+#define VCACHE_SETS 256
+#define VCACHE_KEY_MAX 228
+
+SETCACHE_INIT(vcache, VCACHE_SETS, VCACHE_KEY_MAX, uint64_t, int)
+
+static inline uint64_t vcache_tag(uint32_t cwd_gen, uint32_t wl_gen) {
+    return (uint64_t)cwd_gen << 32 | wl_gen;
+}
+
+static inline uint64_t vcache_hash(const char *s, size_t n) {
+    uint64_t h = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i != n; ++i) h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+    return h;
+}
+
+#endif
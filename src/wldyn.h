@@ -0,0 +1,165 @@
+#ifndef _3e9a7c15_d2f4_4b86_a0c1_64f8b2e7d930
+#define _3e9a7c15_d2f4_4b86_a0c1_64f8b2e7d930
+
+/*
+   Dynamic whitelist: canonical paths added to the whitelist at runtime
+   (the physical paths behind whitelisted symlinks, see the readlink()
+   and realpath() hooks), checked after the index. An entry is exact,
+   a prefix (everything beneath it), or both; the same WL_* flags as in
+   the index are used.
+
+   Readers take no locks. The table is an open-addressing hash set of
+   pointers to entries, which are immutable once published (except for
+   gaining flags) and never removed; a writer fills in an entry and then
+   publishes it with a release store into an empty slot, so a reader
+   either sees the complete entry or an empty slot. When the table is
+   3/4 full a writer copies it into one twice the size and publishes
+   that instead. Retired tables are never unmapped, since readers may
+   still be probing them (together they are smaller than the current
+   one). Writers are serialized by a mutex that readers never touch, so
+   adding an entry only ever delays other writers.
+
+   Entries and tables are mmap()-ed, so that no memory is allocated
+   with malloc() in the hooks.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "wlindex.h"
+
+#define WLDYN_MIN_SLOTS 256
+#define WLDYN_CHUNK (64 * 1024)
+
+typedef struct {
+    uint64_t hash;
+    uint32_t flags;
+    uint32_t len;
+    char path[];
+} wldyn_entry_t;
+
+typedef struct {
+    uint32_t mask;
+    uint32_t n;
+    wldyn_entry_t *slots[];
+} wldyn_table_t;
+
+static wldyn_table_t *g_wldyn = NULL;
+/* number of entries, and of those that are prefixes */
+static uint32_t g_wldyn_entries = 0, g_wldyn_prefixes = 0;
+static pthread_mutex_t g_wldyn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *g_wldyn_chunk = NULL;
+static size_t g_wldyn_chunk_left = 0;
+
+/* Returns the flags of path[0:n], or 0 if it is not in the table */
+static inline uint32_t wldyn_find(const char *path, size_t n, uint64_t hash) {
+    wldyn_table_t *t = __atomic_load_n(&g_wldyn, __ATOMIC_ACQUIRE);
+    uint32_t i;
+    if (t == NULL) return 0;
+    for (i = hash & t->mask; ; i = (i + 1) & t->mask) {
+        wldyn_entry_t *e = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+        if (e == NULL) return 0;
+        if (e->hash == hash && e->len == n && memcmp(e->path, path, n) == 0) {
+            return __atomic_load_n(&e->flags, __ATOMIC_ACQUIRE);
+        }
+    }
+}
+
+static wldyn_table_t *wldyn_alloc_table(uint32_t slots) {
+    wldyn_table_t *t = mmap(NULL, sizeof(wldyn_table_t) + slots * sizeof(wldyn_entry_t *),
+                            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (t == MAP_FAILED) return NULL;
+    t->mask = slots - 1;
+    t->n = 0;
+    return t;
+}
+
+static void wldyn_place(wldyn_table_t *t, wldyn_entry_t *e) {
+    uint32_t i;
+    for (i = e->hash & t->mask; t->slots[i]; i = (i + 1) & t->mask);
+    __atomic_store_n(&t->slots[i], e, __ATOMIC_RELEASE);
+    t->n++;
+}
+
+/* Makes room for one more entry; called with the mutex held */
+static int wldyn_reserve(void) {
+    wldyn_table_t *t = g_wldyn, *bigger;
+    uint32_t i;
+    if (t && 4 * (t->n + 1) <= 3 * (t->mask + 1)) return 0;
+    bigger = wldyn_alloc_table(t ? 2 * (t->mask + 1) : WLDYN_MIN_SLOTS);
+    if (bigger == NULL) return -1;
+    for (i = 0; t && i <= t->mask; ++i) {
+        if (t->slots[i]) wldyn_place(bigger, t->slots[i]);
+    }
+    __atomic_store_n(&g_wldyn, bigger, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static wldyn_entry_t *wldyn_alloc_entry(size_t n) {
+    size_t size = (sizeof(wldyn_entry_t) + n + 1 + 7) & ~(size_t)7;
+    wldyn_entry_t *e;
+    if (size > g_wldyn_chunk_left) {
+        char *chunk = mmap(NULL, WLDYN_CHUNK, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) return NULL;
+        g_wldyn_chunk = chunk;
+        g_wldyn_chunk_left = WLDYN_CHUNK;
+    }
+    e = (wldyn_entry_t *)g_wldyn_chunk;
+    g_wldyn_chunk += size;
+    g_wldyn_chunk_left -= size;
+    return e;
+}
+
+/* Adds path[0:n] (canonical, shorter than PATH_MAX) with `flags`.
+   Returns 1 if the whitelist changed, 0 if the entry was already there
+   and -1 if out of memory. */
+static int wldyn_add(const char *path, size_t n, uint64_t hash, uint32_t flags) {
+    wldyn_entry_t *e;
+    uint32_t i, old;
+    int r = -1;
+    pthread_mutex_lock(&g_wldyn_mutex);
+    for (i = g_wldyn ? hash & g_wldyn->mask : 0; g_wldyn && (e = g_wldyn->slots[i]);
+         i = (i + 1) & g_wldyn->mask) {
+        if (e->hash == hash && e->len == n && memcmp(e->path, path, n) == 0) {
+            old = __atomic_fetch_or(&e->flags, flags, __ATOMIC_RELEASE);
+            if ((flags & WL_PREFIX) && !(old & WL_PREFIX)) {
+                __atomic_add_fetch(&g_wldyn_prefixes, 1, __ATOMIC_RELEASE);
+            }
+            r = (old | flags) != old;
+            goto done;
+        }
+    }
+    if (wldyn_reserve() != 0 || (e = wldyn_alloc_entry(n)) == NULL) goto done;
+    e->hash = hash;
+    e->flags = flags;
+    e->len = n;
+    memcpy(e->path, path, n);
+    e->path[n] = 0;
+    wldyn_place(g_wldyn, e);
+    if (flags & WL_PREFIX) __atomic_add_fetch(&g_wldyn_prefixes, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&g_wldyn_entries, 1, __ATOMIC_RELEASE);
+    r = 1;
+done:
+    pthread_mutex_unlock(&g_wldyn_mutex);
+    return r;
+}
+
+/* Calls fn for every entry, like wlindex_foreach(); stops at and returns
+   the first non-zero result. Entries added meanwhile may be missed. */
+static int wldyn_foreach(int (*fn)(const char *path, uint32_t flags, void *ctx), void *ctx) {
+    wldyn_table_t *t = __atomic_load_n(&g_wldyn, __ATOMIC_ACQUIRE);
+    uint32_t i;
+    int r;
+    for (i = 0; t && i <= t->mask; ++i) {
+        wldyn_entry_t *e = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+        if (e && (r = fn(e->path, __atomic_load_n(&e->flags, __ATOMIC_ACQUIRE), ctx)) != 0) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+#endif
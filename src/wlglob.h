@@ -0,0 +1,479 @@
+#ifndef _e4b27c90_3a1d_4d6f_8f15_6c0b9a2d7e38
+#define _e4b27c90_3a1d_4d6f_8f15_6c0b9a2d7e38
+
+/*
+   Compiles whitelist glob patterns into a single DFA over bytes, so that
+   a canonical path is matched against any number of patterns in one
+   left-to-right scan.
+
+   Syntax, matched against the whole canonical path (<star> is '*'):
+
+       <star>          any run of characters within a component
+       ?               one character other than '/'
+       [abc]           one character of the class; ranges (a-z) and
+                       negation ([!...] or [^...]) are supported, '/'
+                       never matches
+       /<star><star>/  zero or more whole components
+       /<star><star>   at the end: anything strictly below the directory
+       \x              the character x, literally
+
+   <star><star> that is not a whole component counts as <star>.
+
+   Each pattern becomes a small NFA (Thompson construction with byte-set
+   transitions); the NFAs share one start state and are determinized
+   together by subset construction. Bytes are first partitioned into
+   classes that no pattern tells apart, so the transition table has one
+   column per class instead of 256.
+
+   The DFA is returned as:
+
+       uint8_t classes[256]                  byte -> class
+       uint32_t trans[n_states * n_classes]  state, class -> state
+       uint32_t flags[n_states]              WLGLOB_ACCEPT, WLGLOB_ALL
+
+   State 0 is the dead state; WLGLOB_ALL marks accepting states that
+   only loop to themselves, where matching can stop early.
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WLGLOB_MAX_STATES (1 << 16)
+
+enum { WLGLOB_ACCEPT = 1, WLGLOB_ALL = 2 };
+
+typedef struct {
+    uint32_t n_states, n_classes, start;
+    uint8_t classes[256];
+    uint32_t *trans;
+    uint32_t *flags;
+} wlglob_dfa_t;
+
+/* Runs the DFA from state `s` over p[0:n] and returns the state reached;
+   stops early in the dead state and in WLGLOB_ALL states, which both
+   only loop to themselves */
+static inline uint32_t wlglob_run(const uint8_t *classes, const uint32_t *trans,
+                                  const uint32_t *flags, uint32_t n_classes,
+                                  uint32_t s, const char *p, size_t n) {
+    const unsigned char *c = (const unsigned char*)p, *end = c + n;
+    for (; c != end && s != 0 && !(flags[s] & WLGLOB_ALL); ++c) {
+        s = trans[(size_t)s * n_classes + classes[*c]];
+    }
+    return s;
+}
+
+/* Returns 1 if the DFA matches the NUL-terminated path */
+static inline int wlglob_match(const uint8_t *classes, const uint32_t *trans,
+                               const uint32_t *flags, uint32_t n_classes,
+                               uint32_t start, const char *p) {
+    return (flags[wlglob_run(classes, trans, flags, n_classes, start, p, strlen(p))] &
+            WLGLOB_ACCEPT) != 0;
+}
+
+/*
+   Compilation
+*/
+
+typedef struct {
+    uint8_t bits[32];
+} wlglob_set_t;
+
+typedef struct {
+    int32_t set[2];     /* byte transitions, -1 if unused */
+    uint32_t to[2];
+    int32_t eps[2];     /* epsilon transitions, -1 if unused */
+    int accept;
+} wlglob_nstate_t;
+
+typedef struct {
+    wlglob_nstate_t *states;
+    uint32_t n_states, states_capacity;
+    wlglob_set_t *sets;
+    uint32_t n_sets, sets_capacity;
+    int32_t literal_set[256];
+    int oom;
+} wlglob_nfa_t;
+
+enum { WLGLOB_SET_NONSLASH, WLGLOB_SET_SLASH, WLGLOB_SET_ANY };
+
+static inline void wlglob_set_add(wlglob_set_t *s, unsigned char c) {
+    s->bits[c >> 3] |= 1 << (c & 7);
+}
+
+static inline int wlglob_set_has(const wlglob_set_t *s, unsigned char c) {
+    return (s->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+static int32_t wlglob_new_set(wlglob_nfa_t *n) {
+    if (n->n_sets == n->sets_capacity) {
+        uint32_t capacity = n->sets_capacity ? 2 * n->sets_capacity : 64;
+        wlglob_set_t *sets = realloc(n->sets, capacity * sizeof(wlglob_set_t));
+        if (!sets) {
+            n->oom = 1;
+            return WLGLOB_SET_ANY;
+        }
+        n->sets = sets;
+        n->sets_capacity = capacity;
+    }
+    memset(&n->sets[n->n_sets], 0, sizeof(wlglob_set_t));
+    return n->n_sets++;
+}
+
+static int32_t wlglob_literal(wlglob_nfa_t *n, unsigned char c) {
+    if (n->literal_set[c] < 0) {
+        int32_t s = wlglob_new_set(n);
+        if (!n->oom) wlglob_set_add(&n->sets[s], c);
+        n->literal_set[c] = s;
+    }
+    return n->literal_set[c];
+}
+
+static uint32_t wlglob_new_state(wlglob_nfa_t *n) {
+    wlglob_nstate_t *s;
+    if (n->n_states == n->states_capacity) {
+        uint32_t capacity = n->states_capacity ? 2 * n->states_capacity : 256;
+        wlglob_nstate_t *states = realloc(n->states, capacity * sizeof(wlglob_nstate_t));
+        if (!states) {
+            n->oom = 1;
+            return 0;
+        }
+        n->states = states;
+        n->states_capacity = capacity;
+    }
+    s = &n->states[n->n_states];
+    s->set[0] = s->set[1] = s->eps[0] = s->eps[1] = -1;
+    s->accept = 0;
+    return n->n_states++;
+}
+
+static void wlglob_byte(wlglob_nfa_t *n, uint32_t from, int32_t set, uint32_t to) {
+    wlglob_nstate_t *s = &n->states[from];
+    int k = s->set[0] < 0 ? 0 : 1;
+    s->set[k] = set;
+    s->to[k] = to;
+}
+
+static void wlglob_eps(wlglob_nfa_t *n, uint32_t from, uint32_t to) {
+    wlglob_nstate_t *s = &n->states[from];
+    s->eps[s->eps[0] < 0 ? 0 : 1] = to;
+}
+
+/* Adds a transition on `set` from `from` to a new state, which is returned */
+static uint32_t wlglob_step(wlglob_nfa_t *n, uint32_t from, int32_t set) {
+    uint32_t to = wlglob_new_state(n);
+    if (!n->oom) wlglob_byte(n, from, set, to);
+    return to;
+}
+
+/* Parses a character class starting after '['; returns the position after
+   ']', or NULL if it is not terminated (then '[' is taken literally) */
+static const char *wlglob_class(wlglob_nfa_t *n, const char *p, const char *end, int32_t *set) {
+    wlglob_set_t s;
+    int negate = 0, first = 1, i;
+    memset(&s, 0, sizeof(s));
+    if (p != end && (*p == '!' || *p == '^')) {
+        negate = 1;
+        ++p;
+    }
+    while (p != end && (*p != ']' || first)) {
+        unsigned char lo = *p, hi;
+        first = 0;
+        if (lo == '\\' && p + 1 != end) lo = *++p;
+        hi = lo;
+        if (p + 2 < end && p[1] == '-' && p[2] != ']') {
+            p += 2;
+            hi = *p;
+            if (hi == '\\' && p + 1 != end) hi = *++p;
+        }
+        for (i = lo; i <= hi; ++i) wlglob_set_add(&s, i);
+        ++p;
+    }
+    if (p == end) return NULL;
+    if (negate) {
+        for (i = 0; i != 32; ++i) s.bits[i] = ~s.bits[i];
+    }
+    s.bits['/' >> 3] &= ~(1 << ('/' & 7));
+    *set = wlglob_new_set(n);
+    if (!n->oom) n->sets[*set] = s;
+    return p + 1;
+}
+
+/* Emits the body of one component, c[0:end-c], from `cur`; returns the
+   state after it */
+static uint32_t wlglob_component(wlglob_nfa_t *n, uint32_t cur, const char *c, const char *end) {
+    while (c != end && !n->oom) {
+        const char *after;
+        int32_t set;
+        if (*c == '*') {
+            /* one loop state for a run of stars */
+            uint32_t loop = wlglob_new_state(n);
+            if (n->oom) break;
+            wlglob_eps(n, cur, loop);
+            wlglob_byte(n, loop, WLGLOB_SET_NONSLASH, loop);
+            cur = loop;
+            while (c != end && *c == '*') ++c;
+            continue;
+        }
+        if (*c == '?') {
+            set = WLGLOB_SET_NONSLASH;
+            ++c;
+        } else if (*c == '[' && (after = wlglob_class(n, c + 1, end, &set)) != NULL) {
+            c = after;
+        } else {
+            if (*c == '\\' && c + 1 != end) ++c;
+            set = wlglob_literal(n, *c);
+            ++c;
+        }
+        cur = wlglob_step(n, cur, set);
+    }
+    return cur;
+}
+
+/* Adds the pattern p[0:len] (starting with '/') to the NFA, starting
+   from `cur` */
+static void wlglob_add(wlglob_nfa_t *n, uint32_t cur, const char *p, size_t len) {
+    const char *end = p + len, *q;
+    int after_slash = 0; /* cur is just after the '/' of the next component */
+    while (p != end && !n->oom) {
+        /* p is at the '/' that starts a component, which ends at q */
+        for (q = p + 1; q != end && *q != '/'; ++q) {
+            if (*q == '\\' && q + 1 != end) ++q;
+        }
+        if (q - p == 3 && p[1] == '*' && p[2] == '*') {
+            if (!after_slash) cur = wlglob_step(n, cur, WLGLOB_SET_SLASH);
+            if (q == end) {
+                /* at the end: one or more characters of anything */
+                cur = wlglob_step(n, cur, WLGLOB_SET_ANY);
+                if (!n->oom) wlglob_byte(n, cur, WLGLOB_SET_ANY, cur);
+                after_slash = 0;
+            } else if (!after_slash) {
+                /* zero or more "component/"; "**" repeated adds nothing */
+                uint32_t b = wlglob_step(n, cur, WLGLOB_SET_NONSLASH);
+                if (n->oom) return;
+                wlglob_byte(n, b, WLGLOB_SET_NONSLASH, b);
+                wlglob_byte(n, b, WLGLOB_SET_SLASH, cur);
+                after_slash = 1;
+            }
+        } else {
+            if (!after_slash) cur = wlglob_step(n, cur, WLGLOB_SET_SLASH);
+            cur = wlglob_component(n, cur, p + 1, q);
+            after_slash = 0;
+        }
+        p = q;
+    }
+    if (!n->oom) n->states[cur].accept = 1;
+}
+
+/* DFA state sets: sorted arrays of NFA states, deduplicated by hash */
+typedef struct {
+    uint32_t *data;      /* concatenated sets */
+    size_t size, capacity;
+    size_t *offsets;     /* per DFA state, n + 1 entries */
+    uint32_t *table;     /* hash table of DFA state + 1, 0 if empty */
+    uint32_t table_size;
+} wlglob_sets_t;
+
+static uint64_t wlglob_hash_set(const uint32_t *s, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    size_t i;
+    for (i = 0; i != n; ++i) h = (h ^ s[i]) * 1099511628211ULL;
+    return h ^ n;
+}
+
+static int wlglob_cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* epsilon closure of set[0:n] in place (set has room for all NFA states);
+   returns the new size. `mark` has one entry per NFA state. */
+static size_t wlglob_closure(const wlglob_nfa_t *nfa, uint32_t *set, size_t n,
+                             uint32_t *mark, uint32_t gen) {
+    size_t i, m = n;
+    for (i = 0; i != n; ++i) mark[set[i]] = gen;
+    for (i = 0; i != m; ++i) {
+        int k;
+        for (k = 0; k != 2; ++k) {
+            int32_t e = nfa->states[set[i]].eps[k];
+            if (e >= 0 && mark[e] != gen) {
+                mark[e] = gen;
+                set[m++] = e;
+            }
+        }
+    }
+    qsort(set, m, sizeof(uint32_t), wlglob_cmp_u32);
+    return m;
+}
+
+/* Returns the DFA state for set[0:n], adding it if new (*added is set);
+   returns UINT32_MAX on out of memory or too many states */
+static uint32_t wlglob_intern(wlglob_sets_t *ss, uint32_t *n_dfa, const uint32_t *set,
+                              size_t n, int *added) {
+    uint64_t h = wlglob_hash_set(set, n);
+    uint32_t mask = ss->table_size - 1, i = h & mask, id;
+    *added = 0;
+    while (ss->table[i]) {
+        id = ss->table[i] - 1;
+        if (ss->offsets[id + 1] - ss->offsets[id] == n &&
+            memcmp(ss->data + ss->offsets[id], set, n * sizeof(uint32_t)) == 0) return id;
+        i = (i + 1) & mask;
+    }
+    if (*n_dfa == WLGLOB_MAX_STATES) return UINT32_MAX;
+    if (ss->size + n > ss->capacity) {
+        size_t capacity = 2 * (ss->size + n);
+        uint32_t *data = realloc(ss->data, capacity * sizeof(uint32_t));
+        if (!data) return UINT32_MAX;
+        ss->data = data;
+        ss->capacity = capacity;
+    }
+    memcpy(ss->data + ss->size, set, n * sizeof(uint32_t));
+    ss->size += n;
+    id = (*n_dfa)++;
+    ss->offsets[id + 1] = ss->size;
+    ss->table[i] = id + 1;
+    *added = 1;
+    return id;
+}
+
+static void wlglob_free(wlglob_dfa_t *dfa) {
+    free(dfa->trans);
+    free(dfa->flags);
+    dfa->trans = dfa->flags = NULL;
+    dfa->n_states = 0;
+}
+
+/* Makes room for the transitions and flags of n_dfa states */
+static int wlglob_reserve(wlglob_dfa_t *dfa, uint32_t n_dfa, uint32_t *capacity) {
+    uint32_t *trans, *flags;
+    if (n_dfa <= *capacity) return 0;
+    *capacity = 2 * n_dfa;
+    trans = realloc(dfa->trans, (size_t)*capacity * dfa->n_classes * sizeof(uint32_t));
+    if (trans) dfa->trans = trans;
+    flags = realloc(dfa->flags, (size_t)*capacity * sizeof(uint32_t));
+    if (flags) dfa->flags = flags;
+    return trans && flags ? 0 : -1;
+}
+
+/* Compiles patterns[i][0:lens[i]] (each starting with '/') into `dfa`.
+   Returns 0 on success, -1 with errno set to ENOMEM on out of memory or
+   to E2BIG if the automaton would exceed WLGLOB_MAX_STATES states. */
+static int wlglob_compile(const char *const *patterns, const size_t *lens, size_t n_patterns,
+                          wlglob_dfa_t *dfa) {
+    wlglob_nfa_t nfa;
+    wlglob_sets_t ss;
+    uint32_t *set = NULL, *mark = NULL, n_dfa = 0, capacity = 0, gen = 0, hub, i, c, k;
+    uint8_t reps[256];
+    int ret = -1, added, b;
+
+    memset(dfa, 0, sizeof(*dfa));
+    memset(&nfa, 0, sizeof(nfa));
+    memset(&ss, 0, sizeof(ss));
+    for (b = 0; b != 256; ++b) nfa.literal_set[b] = -1;
+    wlglob_new_set(&nfa);
+    wlglob_new_set(&nfa);
+    wlglob_new_set(&nfa);
+    if (nfa.oom) goto out;
+    memset(nfa.sets[WLGLOB_SET_NONSLASH].bits, 0xff, 32);
+    nfa.sets[WLGLOB_SET_NONSLASH].bits['/' >> 3] &= ~(1 << ('/' & 7));
+    wlglob_set_add(&nfa.sets[WLGLOB_SET_SLASH], '/');
+    nfa.literal_set['/'] = WLGLOB_SET_SLASH;
+    memset(nfa.sets[WLGLOB_SET_ANY].bits, 0xff, 32);
+
+    /* NFA state 0 is the start; since a state has two epsilon
+       transitions, the patterns hang off a chain of hub states */
+    hub = wlglob_new_state(&nfa);
+    for (i = 0; i != n_patterns && !nfa.oom; ++i) {
+        uint32_t s = wlglob_new_state(&nfa);
+        if (nfa.oom) break;
+        wlglob_eps(&nfa, hub, s);
+        wlglob_add(&nfa, s, patterns[i], lens[i]);
+        if (i + 1 != n_patterns) {
+            uint32_t next = wlglob_new_state(&nfa);
+            if (nfa.oom) break;
+            wlglob_eps(&nfa, hub, next);
+            hub = next;
+        }
+    }
+    if (nfa.oom) goto out;
+
+    /* byte classes: refine the partition by membership in every set */
+    dfa->n_classes = 1;
+    for (k = 0; k != nfa.n_sets; ++k) {
+        int32_t map[512];
+        uint32_t n_classes = 0;
+        for (c = 0; c != 2 * dfa->n_classes; ++c) map[c] = -1;
+        for (b = 0; b != 256; ++b) {
+            uint32_t key = 2 * dfa->classes[b] + wlglob_set_has(&nfa.sets[k], b);
+            if (map[key] < 0) map[key] = n_classes++;
+            dfa->classes[b] = map[key];
+        }
+        dfa->n_classes = n_classes;
+    }
+    for (b = 255; b >= 0; --b) reps[dfa->classes[b]] = b;
+
+    /* subset construction */
+    set = malloc(nfa.n_states * sizeof(uint32_t));
+    mark = calloc(nfa.n_states, sizeof(uint32_t));
+    ss.offsets = malloc((WLGLOB_MAX_STATES + 1) * sizeof(size_t));
+    ss.table_size = 2 * WLGLOB_MAX_STATES;
+    ss.table = calloc(ss.table_size, sizeof(uint32_t));
+    if (!set || !mark || !ss.offsets || !ss.table) goto out;
+    ss.offsets[0] = 0;
+    if (wlglob_intern(&ss, &n_dfa, set, 0, &added) != 0) goto out; /* dead state */
+    set[0] = 0;
+    dfa->start = wlglob_intern(&ss, &n_dfa, set, wlglob_closure(&nfa, set, 1, mark, ++gen), &added);
+    if (dfa->start == UINT32_MAX) goto out;
+    for (i = 0; i != n_dfa; ++i) {
+        if (wlglob_reserve(dfa, n_dfa, &capacity) != 0) goto out;
+        dfa->flags[i] = 0;
+        for (k = ss.offsets[i]; k != ss.offsets[i + 1]; ++k) {
+            if (nfa.states[ss.data[k]].accept) dfa->flags[i] = WLGLOB_ACCEPT;
+        }
+        for (c = 0; c != dfa->n_classes; ++c) {
+            size_t m = 0;
+            uint32_t to;
+            ++gen;
+            for (k = ss.offsets[i]; k != ss.offsets[i + 1]; ++k) {
+                const wlglob_nstate_t *ns = &nfa.states[ss.data[k]];
+                int t;
+                for (t = 0; t != 2; ++t) {
+                    if (ns->set[t] >= 0 && wlglob_set_has(&nfa.sets[ns->set[t]], reps[c]) &&
+                        mark[ns->to[t]] != gen) {
+                        mark[ns->to[t]] = gen;
+                        set[m++] = ns->to[t];
+                    }
+                }
+            }
+            m = wlglob_closure(&nfa, set, m, mark, ++gen);
+            to = wlglob_intern(&ss, &n_dfa, set, m, &added);
+            if (to == UINT32_MAX) goto out;
+            dfa->trans[(size_t)i * dfa->n_classes + c] = to;
+        }
+    }
+    for (i = 0; i != n_dfa; ++i) {
+        if (!(dfa->flags[i] & WLGLOB_ACCEPT)) continue;
+        for (c = 0; c != dfa->n_classes; ++c) {
+            if (dfa->trans[(size_t)i * dfa->n_classes + c] != i) break;
+        }
+        if (c == dfa->n_classes) dfa->flags[i] |= WLGLOB_ALL;
+    }
+    dfa->n_states = n_dfa;
+    ret = 0;
+ out:
+    if (ret != 0) {
+        wlglob_free(dfa);
+        errno = n_dfa == WLGLOB_MAX_STATES ? E2BIG : ENOMEM;
+    }
+    free(set);
+    free(mark);
+    free(ss.data);
+    free(ss.offsets);
+    free(ss.table);
+    free(nfa.states);
+    free(nfa.sets);
+    return ret;
+}
+
+#endif
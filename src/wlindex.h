@@ -0,0 +1,642 @@
+#ifndef _7c1e4a0d_5b2f_4f60_9d0e_2a8f3c6b9e41
+#define _7c1e4a0d_5b2f_4f60_9d0e_2a8f3c6b9e41
+
+/*
+   Whitelist index: a read-only, position independent representation of
+   a whitelist that can be written to disk and mmap()-ed back in without
+   any parsing. The same layout is used in memory when a whitelist is
+   loaded from a text file, so that there is only one lookup code path.
+
+   The index is a trie over path components. Node 0 is the root ("/");
+   each node has a contiguous, sorted range of outgoing edges labelled
+   with one path component each. A node is flagged WL_EXACT if the path
+   leading to it is whitelisted, and WL_PREFIX if everything strictly
+   below it is ("/path/to/dir/<star><star>"; the root flagged WL_PREFIX
+   whitelists everything).
+
+   Entries with wildcards (see wlglob.h) are not in the trie; they are
+   compiled together into one DFA, which a path is run through if the
+   trie does not whitelist it. Their text is kept for wlindex_foreach().
+
+   Layout (all integers are native endian uint32_t):
+
+       wlindex_header_t
+       wlindex_node_t nodes[n_nodes]      (node 0 is the root)
+       wlindex_edge_t edges[n_edges]
+       uint8_t dfa_classes[256]           (only if dfa_states > 0)
+       uint32_t dfa_trans[dfa_states * dfa_n_classes]
+       uint32_t dfa_flags[dfa_states]
+       char strings[strings_size]         (component names, each
+                                           distinct name stored once)
+       char patterns[patterns_size]       (NUL-terminated each)
+
+   A lookup is a single left-to-right walk over the canonical path, with
+   a binary search among the children at each level; it stops at the
+   first WL_PREFIX node. Patterns cost one more linear scan, however many
+   there are.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "wlglob.h"
+
+#define WLINDEX_MAGIC "HDJAILWL"
+#define WLINDEX_MAGIC_SIZE 8
+#define WLINDEX_VERSION 3
+
+/* WL_PATTERN is only used for builder entries and wlindex_foreach() */
+enum { WL_EXACT = 1, WL_PREFIX = 2, WL_PATTERN = 4 };
+
+typedef struct {
+    char magic[WLINDEX_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t n_entries;
+    uint32_t n_nodes;
+    uint32_t n_edges;
+    uint32_t strings_size;
+    uint32_t n_patterns;
+    uint32_t patterns_size;
+    uint32_t dfa_states;
+    uint32_t dfa_n_classes;
+    uint32_t dfa_start;
+} wlindex_header_t;
+
+typedef struct {
+    uint32_t first_edge;
+    uint32_t n_edges;
+    uint32_t flags;
+} wlindex_node_t;
+
+typedef struct {
+    uint32_t name_offset;
+    uint32_t name_len;
+    uint32_t child;
+} wlindex_edge_t;
+
+typedef struct {
+    const wlindex_header_t *header;
+    const wlindex_node_t *nodes;
+    const wlindex_edge_t *edges;
+    const uint8_t *dfa_classes;
+    const uint32_t *dfa_trans;
+    const uint32_t *dfa_flags;
+    const char *strings;
+    const char *patterns;
+} wlindex_t;
+
+static inline size_t wlindex_dfa_size(const wlindex_header_t *h) {
+    if (h->dfa_states == 0) return 0;
+    return 256 + ((size_t)h->dfa_states * h->dfa_n_classes + h->dfa_states) * sizeof(uint32_t);
+}
+
+/* Validates a buffer holding an index and sets up `idx` to refer into it
+   (no copy is made). Returns 0 on success, -1 if the buffer is not a valid
+   index. */
+static inline int wlindex_open(wlindex_t *idx, const void *buf, size_t size) {
+    const wlindex_header_t *h = buf;
+    size_t expected;
+    uint32_t i;
+    if (size < sizeof(wlindex_header_t)) return -1;
+    if (memcmp(h->magic, WLINDEX_MAGIC, WLINDEX_MAGIC_SIZE) != 0) return -1;
+    if (h->version != WLINDEX_VERSION) return -1;
+    if (h->n_nodes == 0) return -1;
+    if (h->dfa_states != 0 && (h->dfa_n_classes == 0 || h->dfa_n_classes > 256 ||
+                               h->dfa_start >= h->dfa_states)) return -1;
+    expected = sizeof(wlindex_header_t) + (size_t)h->n_nodes * sizeof(wlindex_node_t)
+        + (size_t)h->n_edges * sizeof(wlindex_edge_t) + wlindex_dfa_size(h)
+        + h->strings_size + h->patterns_size;
+    if (size < expected) return -1;
+    idx->header = h;
+    idx->nodes = (const wlindex_node_t*)(h + 1);
+    idx->edges = (const wlindex_edge_t*)(idx->nodes + h->n_nodes);
+    idx->dfa_classes = (const uint8_t*)(idx->edges + h->n_edges);
+    idx->dfa_trans = (const uint32_t*)(idx->dfa_classes + (h->dfa_states ? 256 : 0));
+    idx->dfa_flags = idx->dfa_trans + (size_t)h->dfa_states * h->dfa_n_classes;
+    idx->strings = (const char*)(idx->dfa_flags + h->dfa_states);
+    idx->patterns = idx->strings + h->strings_size;
+    if (h->patterns_size != 0 && idx->patterns[h->patterns_size - 1] != 0) return -1;
+    /* bounds-check so that a corrupt file can not make lookups stray */
+    for (i = 0; i != h->n_nodes; ++i) {
+        if (idx->nodes[i].first_edge > h->n_edges ||
+            idx->nodes[i].n_edges > h->n_edges - idx->nodes[i].first_edge) return -1;
+    }
+    for (i = 0; i != h->n_edges; ++i) {
+        if (idx->edges[i].child >= h->n_nodes ||
+            idx->edges[i].name_offset > h->strings_size ||
+            idx->edges[i].name_len > h->strings_size - idx->edges[i].name_offset) return -1;
+    }
+    for (i = 0; i != (h->dfa_states ? 256 : 0); ++i) {
+        if (idx->dfa_classes[i] >= h->dfa_n_classes) return -1;
+    }
+    for (i = 0; i != h->dfa_states * h->dfa_n_classes; ++i) {
+        if (idx->dfa_trans[i] >= h->dfa_states) return -1;
+    }
+    return 0;
+}
+
+/* Compares a component name with an edge label; shorter sorts first */
+static inline int wl_name_cmp(const char *a, size_t na, const char *b, size_t nb) {
+    int c = memcmp(a, b, na < nb ? na : nb);
+    if (c != 0) return c;
+    return (na > nb) - (na < nb);
+}
+
+/* Returns the child of `node` along component s[0:n], or -1 */
+static inline int64_t wlindex_child(const wlindex_t *idx, uint32_t node,
+                                    const char *s, size_t n) {
+    const wlindex_node_t *nd = &idx->nodes[node];
+    const wlindex_edge_t *edges = idx->edges + nd->first_edge;
+    uint32_t lo = 0, hi = nd->n_edges;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = wl_name_cmp(s, n, idx->strings + edges[mid].name_offset, edges[mid].name_len);
+        if (c == 0) return edges[mid].child;
+        if (c < 0) hi = mid; else lo = mid + 1;
+    }
+    return -1;
+}
+
+static inline int wlindex_lookup_trie(const wlindex_t *idx, const char *p) {
+    uint32_t node = 0;
+    ++p;
+    while (*p) {
+        const char *end;
+        int64_t child;
+        if (idx->nodes[node].flags & WL_PREFIX) return 1;
+        end = p;
+        while (*end && *end != '/') ++end;
+        child = wlindex_child(idx, node, p, end - p);
+        if (child < 0) return 0;
+        node = child;
+        p = *end ? end + 1 : end;
+    }
+    return (idx->nodes[node].flags & WL_EXACT) != 0;
+}
+
+/* p should be an absolute/canonical path. Returns 1 if p is whitelisted,
+   either exactly, by being below a prefix entry, or by matching a
+   pattern. */
+static inline int wlindex_lookup(const wlindex_t *idx, const char *p) {
+    const wlindex_header_t *h = idx->header;
+    if (h == NULL || h->n_entries == 0 || p[0] != '/') return 0;
+    if (wlindex_lookup_trie(idx, p)) return 1;
+    return h->dfa_states != 0 &&
+        wlglob_match(idx->dfa_classes, idx->dfa_trans, idx->dfa_flags, h->dfa_n_classes,
+                     h->dfa_start, p);
+}
+
+/* A position in the whitelist after walking a directory, from which the
+   entries directly in it can be looked up by name; see wlindex_dir() */
+#define WLINDEX_COVERED UINT32_MAX      /* below a prefix entry */
+#define WLINDEX_ABSENT (UINT32_MAX - 1) /* not in the trie */
+
+typedef struct {
+    uint32_t node; /* trie node of the directory, or one of the above */
+    uint32_t dfa;  /* DFA state after "<dir>/" (0: no pattern can match) */
+} wlindex_cursor_t;
+
+/* Walks the canonical directory dir[0:n] (n == 0 for the root) and sets
+   *cur so that wlindex_lookup_in(idx, cur, name) gives the same verdict
+   as wlindex_lookup() on "<dir>/<name>" */
+static inline void wlindex_dir(const wlindex_t *idx, const char *dir, size_t n,
+                               wlindex_cursor_t *cur) {
+    const wlindex_header_t *h = idx->header;
+    const char *p = dir + 1, *end = dir + n;
+    uint32_t node = 0;
+    cur->node = WLINDEX_ABSENT;
+    cur->dfa = 0;
+    if (h == NULL || h->n_entries == 0) return;
+    if (h->dfa_states != 0) {
+        cur->dfa = wlglob_run(idx->dfa_classes, idx->dfa_trans, idx->dfa_flags,
+                              h->dfa_n_classes, h->dfa_start, dir, n);
+        cur->dfa = wlglob_run(idx->dfa_classes, idx->dfa_trans, idx->dfa_flags,
+                              h->dfa_n_classes, cur->dfa, "/", 1);
+    }
+    while (1) {
+        const char *q;
+        int64_t child;
+        if (idx->nodes[node].flags & WL_PREFIX) {
+            cur->node = WLINDEX_COVERED;
+            return;
+        }
+        if (p >= end) break;
+        for (q = p; q != end && *q != '/'; ++q);
+        child = wlindex_child(idx, node, p, q - p);
+        if (child < 0) return;
+        node = child;
+        p = q + 1;
+    }
+    cur->node = node;
+}
+
+/* Returns 1 if the entry `name` (a single component) in the directory
+   walked to `cur` is whitelisted */
+static inline int wlindex_lookup_in(const wlindex_t *idx, const wlindex_cursor_t *cur,
+                                    const char *name) {
+    const wlindex_header_t *h = idx->header;
+    if (cur->node == WLINDEX_COVERED) return 1;
+    if (cur->node != WLINDEX_ABSENT) {
+        int64_t child = wlindex_child(idx, cur->node, name, strlen(name));
+        if (child >= 0 && (idx->nodes[child].flags & WL_EXACT)) return 1;
+    }
+    return cur->dfa != 0 &&
+        (idx->dfa_flags[wlglob_run(idx->dfa_classes, idx->dfa_trans, idx->dfa_flags,
+                                   h->dfa_n_classes, cur->dfa, name, strlen(name))] &
+         WLGLOB_ACCEPT) != 0;
+}
+
+static inline int wlindex_foreach_node(const wlindex_t *idx, uint32_t node, char *path, size_t len,
+                                       int (*fn)(const char *path, uint32_t flags, void *ctx),
+                                       void *ctx) {
+    const wlindex_node_t *nd = &idx->nodes[node];
+    uint32_t i;
+    int r;
+    if (nd->flags) {
+        if ((r = fn(len ? path : "/", nd->flags, ctx)) != 0) return r;
+    }
+    for (i = 0; i != nd->n_edges; ++i) {
+        const wlindex_edge_t *e = &idx->edges[nd->first_edge + i];
+        if (len + 1 + e->name_len >= PATH_MAX) continue;
+        path[len] = '/';
+        memcpy(path + len + 1, idx->strings + e->name_offset, e->name_len);
+        path[len + 1 + e->name_len] = 0;
+        r = wlindex_foreach_node(idx, e->child, path, len + 1 + e->name_len, fn, ctx);
+        if (r != 0) return r;
+    }
+    return 0;
+}
+
+/* Calls fn(path, flags, ctx) for every whitelisted node (flagged WL_EXACT
+   and/or WL_PREFIX, with the path leading to it), depth first, and then
+   for every pattern (flagged WL_PATTERN); entries longer than PATH_MAX
+   are skipped. Stops at, and returns, the first nonzero value returned
+   by fn. */
+static inline int wlindex_foreach(const wlindex_t *idx,
+                                  int (*fn)(const char *path, uint32_t flags, void *ctx),
+                                  void *ctx) {
+    char path[PATH_MAX];
+    const char *pattern;
+    int r;
+    if (idx->header == NULL) return 0;
+    path[0] = 0;
+    if ((r = wlindex_foreach_node(idx, 0, path, 0, fn, ctx)) != 0) return r;
+    for (pattern = idx->patterns; pattern != idx->patterns + idx->header->patterns_size;
+         pattern += strlen(pattern) + 1) {
+        if ((r = fn(pattern, WL_PATTERN, ctx)) != 0) return r;
+    }
+    return 0;
+}
+
+/*
+   Building an index
+*/
+
+typedef struct {
+    char *path;
+    size_t len;
+    uint32_t kind;
+} wlindex_entry_t;
+
+typedef struct {
+    wlindex_entry_t *entries;
+    size_t n, capacity;
+} wlindex_builder_t;
+
+static void wlindex_builder_init(wlindex_builder_t *b) {
+    b->entries = NULL;
+    b->n = b->capacity = 0;
+}
+
+static void wlindex_builder_free(wlindex_builder_t *b) {
+    size_t i;
+    for (i = 0; i != b->n; ++i) free(b->entries[i].path);
+    free(b->entries);
+    wlindex_builder_init(b);
+}
+
+/* Adds an entry that is already in normal form; ownership of `path` is
+   taken. Returns -1 (and frees `path`) on out of memory. */
+static int wlindex_builder_push(wlindex_builder_t *b, char *path, size_t len, uint32_t kind) {
+    if (b->n == b->capacity) {
+        size_t capacity = b->capacity ? 2 * b->capacity : 64;
+        wlindex_entry_t *entries = realloc(b->entries, capacity * sizeof(wlindex_entry_t));
+        if (!entries) {
+            free(path);
+            return -1;
+        }
+        b->entries = entries;
+        b->capacity = capacity;
+    }
+    b->entries[b->n].path = path;
+    b->entries[b->n].len = len;
+    b->entries[b->n].kind = kind;
+    b->n++;
+    return 0;
+}
+
+/* Adds one whitelist line (without trailing newline); ownership of `line`
+   is taken. Blank lines are ignored. Returns -1 (and frees `line`) if the
+   entry is not an absolute path or on out of memory. */
+static int wlindex_builder_add(wlindex_builder_t *b, char *line) {
+    size_t r = strlen(line);
+    uint32_t kind = WL_EXACT;
+    if (r == 0) {
+        free(line);
+        return 0;
+    }
+    if (line[0] != '/') {
+        free(line);
+        return -1;
+    }
+    {
+        /* collapse repeated and trailing slashes, so that entries are
+           comparable with canonical paths */
+        char *src = line, *dst = line;
+        while (*src) {
+            if (!(src[0] == '/' && (src[1] == '/' || (src[1] == 0 && dst != line)))) {
+                *dst++ = *src;
+            }
+            ++src;
+        }
+        *dst = 0;
+        r = dst - line;
+    }
+    if (strcspn(line, "*?[") != r) {
+        /* a "/<star><star>" suffix alone is a prefix entry in the trie;
+           anything else with wildcards is a pattern */
+        if (r >= 3 && strcmp(&line[r - 3], "/**") == 0 && strcspn(line, "*?[") == r - 2) {
+            r -= 3;
+            line[r] = 0; /* truncate */
+            kind = WL_PREFIX;
+        } else {
+            kind = WL_PATTERN;
+        }
+    }
+    return wlindex_builder_push(b, line, r, kind);
+}
+
+/* Reads a text whitelist (one entry per line) into the builder. Returns -1
+   if an entry is not an absolute path. */
+static int wlindex_builder_add_file(wlindex_builder_t *b, FILE *fd) {
+    while (1) {
+        char *line = NULL;
+        size_t n = 0;
+        ssize_t r;
+        if ((r = getline(&line, &n, fd)) == -1) {
+            free(line);
+            break;
+        }
+        /* strip trailing newline if any */
+        if (r > 0 && line[r - 1] == '\n') line[r - 1] = 0;
+        if (wlindex_builder_add(b, line) != 0) return -1;
+    }
+    return 0;
+}
+
+static int wlindex_builder_add_entry(const char *path, uint32_t flags, void *ctx) {
+    uint32_t kinds[] = {WL_EXACT, WL_PREFIX, WL_PATTERN};
+    size_t len = strlen(path);
+    int i;
+    for (i = 0; i != 3; ++i) {
+        char *copy;
+        if (!(flags & kinds[i])) continue;
+        if (!(copy = malloc(len + 1))) return -1;
+        memcpy(copy, path, len + 1);
+        if (wlindex_builder_push(ctx, copy, len, kinds[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+/* Adds all entries of an index (e.g., a precompiled whitelist) to the
+   builder. Returns -1 on out of memory. */
+static int wlindex_builder_add_index(wlindex_builder_t *b, const wlindex_t *idx) {
+    return wlindex_foreach(idx, wlindex_builder_add_entry, b);
+}
+
+/* A 64-bit hash of buf[0:n], continuing from h (start with 0); used to
+   name cached indexes by the contents they were built from */
+static inline uint64_t wlindex_content_hash(const void *buf, size_t n, uint64_t h) {
+    const unsigned char *p = buf;
+    const uint64_t m = 0x9e3779b97f4a7c15ULL;
+    h ^= n * m;
+    while (n >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * m;
+        h ^= h >> 29;
+        p += 8;
+        n -= 8;
+    }
+    while (n--) {
+        h = (h ^ *p++) * m;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+/* Orders paths component by component, i.e., as if '/' sorted before any
+   other character; this gives the order of edges in the trie */
+static int wl_path_cmp(const void *pa, const void *pb) {
+    const unsigned char *a = (const unsigned char*)((const wlindex_entry_t*)pa)->path;
+    const unsigned char *b = (const unsigned char*)((const wlindex_entry_t*)pb)->path;
+    while (*a && *a == *b) ++a, ++b;
+    if (*a == *b) return 0;
+    if (*a == '/') return *b ? -1 : 1;
+    if (*b == '/') return *a ? 1 : -1;
+    return (int)*a - (int)*b;
+}
+
+/* temporary trie used while building; children are kept in sorted order
+   since entries are inserted sorted */
+typedef struct {
+    uint32_t flags, first_child, last_child, next_sibling, n_children;
+    const char *name;
+    uint32_t name_len, name_offset;
+    uint32_t index; /* position in output */
+} wl_tmpnode_t;
+
+/* Interns tmp[i].name in `table` (open addressing, of size mask + 1, holding
+   tmp indices + 1); sets its name_offset, and returns 1 if it is new */
+static int wl_intern_name(wl_tmpnode_t *tmp, uint32_t *table, uint32_t mask, uint32_t i,
+                          size_t strings_size) {
+    uint32_t h = (uint32_t)wlindex_content_hash(tmp[i].name, tmp[i].name_len, 0) & mask;
+    while (table[h]) {
+        const wl_tmpnode_t *t = &tmp[table[h] - 1];
+        if (t->name_len == tmp[i].name_len && memcmp(t->name, tmp[i].name, t->name_len) == 0) {
+            tmp[i].name_offset = t->name_offset;
+            return 0;
+        }
+        h = (h + 1) & mask;
+    }
+    table[h] = i + 1;
+    tmp[i].name_offset = strings_size;
+    return 1;
+}
+
+/* Serializes the builder contents into a newly malloc()-ed index buffer;
+   the size is returned in *size. The builder entries are sorted in the
+   process. Returns NULL with errno set on out of memory (ENOMEM) or if the
+   patterns are too complex to compile (E2BIG). */
+static void *wlindex_build(wlindex_builder_t *b, size_t *size) {
+    wl_tmpnode_t *tmp = NULL;
+    uint32_t n_tmp = 1, capacity = 64, n_nodes, n_edges, n_entries = 0, n_patterns = 0;
+    uint32_t *queue = NULL, *names = NULL, names_size;
+    size_t strings_size = 0, patterns_size = 0, dfa_size, i, head, tail;
+    const char **patterns = NULL;
+    size_t *pattern_lens = NULL;
+    char *buf = NULL, *strings, *p;
+    wlglob_dfa_t dfa;
+    wlindex_header_t *h;
+    wlindex_node_t *nodes;
+    wlindex_edge_t *edges;
+
+    memset(&dfa, 0, sizeof(dfa));
+    qsort(b->entries, b->n, sizeof(wlindex_entry_t), wl_path_cmp);
+
+    /* patterns go into one automaton; sorting made duplicates adjacent */
+    patterns = malloc((b->n + 1) * sizeof(char*));
+    pattern_lens = malloc((b->n + 1) * sizeof(size_t));
+    if (!patterns || !pattern_lens) goto oom;
+    for (i = 0; i != b->n; ++i) {
+        if (b->entries[i].kind != WL_PATTERN) continue;
+        if (n_patterns != 0 && strcmp(patterns[n_patterns - 1], b->entries[i].path) == 0) continue;
+        patterns[n_patterns] = b->entries[i].path;
+        pattern_lens[n_patterns++] = b->entries[i].len;
+        patterns_size += b->entries[i].len + 1;
+    }
+    if (n_patterns != 0 && wlglob_compile(patterns, pattern_lens, n_patterns, &dfa) != 0) {
+        goto fail;
+    }
+
+    tmp = calloc(capacity, sizeof(wl_tmpnode_t));
+    if (!tmp) goto oom;
+    for (i = 0; i != b->n; ++i) {
+        const char *p = b->entries[i].path + 1, *end = b->entries[i].path + b->entries[i].len;
+        uint32_t node = 0;
+        if (b->entries[i].kind == WL_PATTERN) continue;
+        while (p < end) {
+            const char *q = p + 1;
+            uint32_t last;
+            while (q != end && *q != '/') ++q;
+            last = tmp[node].last_child;
+            if (last != 0 && wl_name_cmp(p, q - p, tmp[last].name, tmp[last].name_len) == 0) {
+                node = last;
+            } else {
+                if (n_tmp == capacity) {
+                    wl_tmpnode_t *t = realloc(tmp, 2 * capacity * sizeof(wl_tmpnode_t));
+                    if (!t) goto oom;
+                    tmp = t;
+                    capacity *= 2;
+                }
+                memset(&tmp[n_tmp], 0, sizeof(wl_tmpnode_t));
+                tmp[n_tmp].name = p;
+                tmp[n_tmp].name_len = q - p;
+                if (last != 0) tmp[last].next_sibling = n_tmp; else tmp[node].first_child = n_tmp;
+                tmp[node].last_child = n_tmp;
+                tmp[node].n_children++;
+                node = n_tmp++;
+            }
+            p = q + 1;
+        }
+        if (!(tmp[node].flags & b->entries[i].kind)) n_entries++;
+        tmp[node].flags |= b->entries[i].kind;
+    }
+
+    /* Lay out nodes breadth-first so that the children of each node are
+       contiguous. Subtrees below prefix entries are dropped, since lookups
+       stop there anyway. */
+    queue = malloc(n_tmp * sizeof(uint32_t));
+    for (names_size = 1; names_size < 2 * n_tmp; names_size *= 2);
+    names = calloc(names_size, sizeof(uint32_t));
+    if (!queue || !names) goto oom;
+    queue[0] = 0;
+    n_nodes = 1;
+    n_edges = 0;
+    for (head = 0; head != n_nodes; ++head) {
+        uint32_t child;
+        if (tmp[queue[head]].flags & WL_PREFIX) continue;
+        for (child = tmp[queue[head]].first_child; child != 0; child = tmp[child].next_sibling) {
+            tmp[child].index = n_nodes;
+            queue[n_nodes++] = child;
+            n_edges++;
+            if (wl_intern_name(tmp, names, names_size - 1, child, strings_size)) {
+                strings_size += tmp[child].name_len;
+            }
+        }
+    }
+
+    dfa_size = dfa.n_states ? 256 + ((size_t)dfa.n_states * dfa.n_classes + dfa.n_states) * sizeof(uint32_t) : 0;
+    *size = sizeof(wlindex_header_t) + n_nodes * sizeof(wlindex_node_t)
+        + n_edges * sizeof(wlindex_edge_t) + dfa_size + strings_size + patterns_size;
+    buf = calloc(1, *size);
+    if (!buf) goto oom;
+    h = (wlindex_header_t*)buf;
+    nodes = (wlindex_node_t*)(h + 1);
+    edges = (wlindex_edge_t*)(nodes + n_nodes);
+    p = (char*)(edges + n_edges);
+    if (dfa.n_states) {
+        memcpy(p, dfa.classes, 256);
+        p += 256;
+        memcpy(p, dfa.trans, (size_t)dfa.n_states * dfa.n_classes * sizeof(uint32_t));
+        p += (size_t)dfa.n_states * dfa.n_classes * sizeof(uint32_t);
+        memcpy(p, dfa.flags, dfa.n_states * sizeof(uint32_t));
+        p += dfa.n_states * sizeof(uint32_t);
+    }
+    strings = p;
+
+    tail = 0;
+    for (head = 0; head != n_nodes; ++head) {
+        const wl_tmpnode_t *t = &tmp[queue[head]];
+        uint32_t child;
+        nodes[head].flags = t->flags;
+        nodes[head].first_edge = tail;
+        if (t->flags & WL_PREFIX) continue;
+        for (child = t->first_child; child != 0; child = tmp[child].next_sibling) {
+            edges[tail].name_offset = tmp[child].name_offset;
+            edges[tail].name_len = tmp[child].name_len;
+            edges[tail].child = tmp[child].index;
+            memcpy(strings + tmp[child].name_offset, tmp[child].name, tmp[child].name_len);
+            tail++;
+            nodes[head].n_edges++;
+        }
+    }
+    p = strings + strings_size;
+    for (i = 0; i != n_patterns; ++i) {
+        memcpy(p, patterns[i], pattern_lens[i] + 1);
+        p += pattern_lens[i] + 1;
+    }
+
+    memcpy(h->magic, WLINDEX_MAGIC, WLINDEX_MAGIC_SIZE);
+    h->version = WLINDEX_VERSION;
+    h->n_entries = n_entries + n_patterns;
+    h->n_nodes = n_nodes;
+    h->n_edges = n_edges;
+    h->strings_size = strings_size;
+    h->n_patterns = n_patterns;
+    h->patterns_size = patterns_size;
+    h->dfa_states = dfa.n_states;
+    h->dfa_n_classes = dfa.n_classes;
+    h->dfa_start = dfa.start;
+    goto done;
+ oom:
+    errno = ENOMEM;
+ fail:
+    free(buf);
+    buf = NULL;
+ done:
+    wlglob_free(&dfa);
+    free(names);
+    free(queue);
+    free(tmp);
+    free(patterns);
+    free(pattern_lens);
+    return buf;
+}
+
+#endif
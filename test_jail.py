@@ -12,11 +12,24 @@ import shutil
 from textwrap import dedent
 import errno
 import functools
+import ctypes
+import json
+from unittest import SkipTest
 import nose
 from nose.tools import ok_, eq_
 from glob import glob
 
 JAIL_SO = os.path.realpath(pjoin(os.path.dirname(__file__), 'build', 'hdistjail.so'))
+LOG_JAIL_SO = os.path.realpath(pjoin(os.path.dirname(__file__), 'build', 'hdistjail-log.so'))
+HIDE_JAIL_SO = os.path.realpath(pjoin(os.path.dirname(__file__), 'build', 'hdistjail-hide.so'))
+STATS_JAIL_SO = os.path.realpath(pjoin(os.path.dirname(__file__), 'build', 'hdistjail-stats.so'))
+WHITELIST_TOOL = os.path.realpath(pjoin(os.path.dirname(__file__), 'build', 'hdistjail-whitelist'))
+COLLECT_TOOL = os.path.realpath(pjoin(os.path.dirname(__file__), 'build', 'hdistjail-collect'))
+LOGSTAT_TOOL = os.path.realpath(pjoin(os.path.dirname(__file__), 'build', 'hdistjail-logstat'))
+STATS_TOOL = os.path.realpath(pjoin(os.path.dirname(__file__), 'build', 'hdistjail-stats'))
+REPLAY_TOOL = os.path.realpath(pjoin(os.path.dirname(__file__), 'build', 'hdistjail-replay'))
+FOLD_TOOL = os.path.realpath(pjoin(os.path.dirname(__file__), 'build', 'hdistjail-fold'))
+LOGRING_H = os.path.realpath(pjoin(os.path.dirname(__file__), 'src', 'logring.h'))
 
 #
 # Fixture/utils
@@ -56,9 +69,10 @@ def mock_files(tempdir, filenames):
         with file(p, 'w') as f:
             f.write('contents\n')
 
-def compile(path, main_func_code):
+def compile(path, main_func_code, toplevel_code=''):
     with file(path + '.c', 'w') as f:
         f.write(dedent('''
+        #define _GNU_SOURCE
         #include <stdio.h>
         #include <stdlib.h>
         #include <sys/types.h>
@@ -66,32 +80,55 @@ def compile(path, main_func_code):
         #include <unistd.h>
         #include <fcntl.h>
         #include <errno.h>
+        #include <sys/wait.h>
+        #include <dirent.h>
 
-        int main() {
+        %s
+
+        int main(int argc, char *argv[]) {
         %s
         return 0;
         }
-        ''') % main_func_code)
-    subprocess.check_call(['gcc', '-O0', '-g', '-o', path, path + '.c'])
+        ''') % (toplevel_code, main_func_code))
+    subprocess.check_call(['gcc', '-O0', '-g', '-pthread', '-o', path, path + '.c'])
 
 def run_in_jail(tempdir,
                 main_func_code,
                 jail_mode=None,
                 whitelist=None,
                 stderr=False,
-                should_log=True):
+                should_log=True,
+                precompile_whitelist=False,
+                extra_env=None,
+                toplevel_code='',
+                check_pid=True,
+                with_pids=False,
+                collect=False,
+                binary=False,
+                jail_so=JAIL_SO):
     work_dir = pjoin(tempdir, 'work')
     executable = pjoin(tempdir, 'test')
-    compile(executable, dedent(main_func_code))
+    compile(executable, dedent(main_func_code), dedent(toplevel_code))
     cmd = [executable]
-    env = dict(LD_PRELOAD=JAIL_SO)
+    env = dict(LD_PRELOAD=jail_so)
     if jail_mode:
         env['HDIST_JAIL_MODE'] = jail_mode
     if should_log:
         log_filename = pjoin(tempdir, 'log')
         env['HDIST_JAIL_LOG'] = log_filename
+    if collect:
+        # log through a small shared-memory ring drained by the collector
+        env.pop('LD_PRELOAD')
+        env.pop('HDIST_JAIL_LOG', None)
+        cmd = [COLLECT_TOOL, '-o', log_filename, '-s', '64', '-p', jail_so] + cmd
+        if binary:
+            cmd.insert(1, '-b')
+    elif binary:
+        env['HDIST_JAIL_LOG_FORMAT'] = 'binary'
     if stderr:
         env['HDIST_JAIL_STDERR'] = 'hdistjail: '
+    if extra_env:
+        env.update(extra_env)
 
     if whitelist is not None:
         # make whitelist contain absolute paths
@@ -101,6 +138,9 @@ def run_in_jail(tempdir,
         whitelist_path = pjoin(tempdir, 'whitelist.txt')
         with file(whitelist_path, 'w') as f:
             f.write('\n'.join(whitelist) + '\n')
+        if precompile_whitelist:
+            subprocess.check_call([WHITELIST_TOOL, whitelist_path, whitelist_path + '.idx'])
+            whitelist_path += '.idx'
         env['HDIST_JAIL_WHITELIST'] = whitelist_path
 
     # make a bash script too in case manual debugging is needed
@@ -120,14 +160,20 @@ def run_in_jail(tempdir,
     out, err = proc.communicate()
     ret = proc.wait()
     if ret != 0:
-        raise subprocess.CalledProcessError(cmd, ret)
+        raise subprocess.CalledProcessError(ret, cmd)
     lines = [x for x in out.splitlines() if x]
     if should_log:
+        if binary:
+            # decode to the text format
+            with file(log_filename + '.txt', 'w') as f:
+                subprocess.check_call([LOGSTAT_TOOL, '-d', log_filename], stdout=f)
+            os.rename(log_filename + '.txt', log_filename)
         with file(log_filename) as f:
             log_lines = [x[:-1].split(' ', 1) for x in f.readlines()]
         os.unlink(log_filename)
-        assert all(int(tup[0]) == proc.pid for tup in log_lines)
-        log = [tup[1] for tup in log_lines]
+        if check_pid and not collect:
+            assert all(int(tup[0]) == proc.pid for tup in log_lines)
+        log = log_lines if with_pids else [tup[1] for tup in log_lines]
     else:
         log = None
     return log, lines
@@ -181,6 +227,936 @@ def test_whitelist_behaviour(tempdir):
     eq_([1, 1, 0, 1], out)
     eq_(['%s/work/hiddenfile// open' % tempdir], log)
 
+@fixture()
+def test_precompiled_whitelist(tempdir):
+    mock_files(tempdir, ['okfile', 'hiddenfile', 'subdir/foo', 'subdir/bar',
+                         'subdir-x/foo', 'subdir-x/bar'])
+    checks = ['open("okfile", O_RDONLY) != -1',
+              'open("hiddenfile", O_RDONLY) != -1',
+              'open("subdir/foo", O_RDONLY) != -1',
+              'open("subdir", O_RDONLY) != -1',
+              'open("subdir-x/foo", O_RDONLY) != -1',
+              'open("subdir-x/bar", O_RDONLY) != -1',
+              ]
+    whitelist = ['okfile', 'subdir/**', 'okfile', 'subdir-x//foo']
+    log, out = run_int_checks(tempdir, '', checks, jail_mode='hide',
+                              whitelist=whitelist, precompile_whitelist=True)
+    eq_([1, 0, 1, 0, 1, 0], out)
+    eq_(['%s/work/hiddenfile// open' % tempdir,
+         '%s/work/subdir// open' % tempdir,
+         '%s/work/subdir-x/bar// open' % tempdir], log)
+    # the root prefix whitelists everything
+    log, out = run_int_checks(tempdir, '', checks, jail_mode='hide',
+                              whitelist=['/**'], precompile_whitelist=True)
+    eq_([1, 1, 1, 1, 1, 1], out)
+    eq_([], log)
+
+@fixture()
+def test_glob_whitelist(tempdir):
+    mock_files(tempdir, ['inc/a.h', 'inc/sys/b.h', 'inc/sys/b.c', 'lib/x1/libz.so',
+                         'lib/x2/sub/libz.so', 'data/f1', 'data/f12', 'data/fx',
+                         'star/*', 'star/s'])
+    checks = ['open("inc/a.h", O_RDONLY) != -1',
+              'open("inc/sys/b.h", O_RDONLY) != -1',
+              'open("inc/sys/b.c", O_RDONLY) != -1',
+              'open("lib/x1/libz.so", O_RDONLY) != -1',
+              'open("lib/x2/sub/libz.so", O_RDONLY) != -1',
+              'open("data/f1", O_RDONLY) != -1',
+              'open("data/f12", O_RDONLY) != -1',
+              'open("data/fx", O_RDONLY) != -1',
+              'open("star/*", O_RDONLY) != -1',
+              'open("star/s", O_RDONLY) != -1',
+              ]
+    whitelist = ['inc/**/*.h', 'lib/*/libz.so', 'data/f[0-9]', r'star/\*']
+    for precompile in [False, True]:
+        log, out = run_int_checks(tempdir, '', checks, jail_mode='hide',
+                                  whitelist=whitelist, precompile_whitelist=precompile)
+        eq_([1, 1, 0, 1, 0, 1, 0, 0, 1, 0], out)
+        eq_(['%s/work/%s// open' % (tempdir, x)
+             for x in ['inc/sys/b.c', 'lib/x2/sub/libz.so', 'data/f12', 'data/fx', 'star/s']],
+            log)
+
+@fixture()
+def test_layered_whitelist(tempdir):
+    mock_files(tempdir, ['base/a', 'pkg/b', 'pkg/c', 'step/d', 'step/e', 'other'])
+    checks = ['open("base/a", O_RDONLY) != -1',
+              'open("pkg/b", O_RDONLY) != -1',
+              'open("pkg/c", O_RDONLY) != -1',
+              'open("step/d", O_RDONLY) != -1',
+              'open("step/e", O_RDONLY) != -1',
+              'open("other", O_RDONLY) != -1',
+              ]
+    work = pjoin(tempdir, 'work')
+    def write_layer(name, entries):
+        path = pjoin(tempdir, name)
+        with file(path, 'w') as f:
+            f.write(''.join(pjoin(work, x) + '\n' for x in entries))
+        return path
+    base = write_layer('base.txt', ['base/**'])
+    pkg = write_layer('pkg.txt', ['pkg/b', 'base/a'])
+    subprocess.check_call([WHITELIST_TOOL, pkg, pkg + '.idx'])
+    step = write_layer('step.txt', ['step/d'])
+    layers = ':'.join([base, pkg + '.idx', step])
+    cache_dir = pjoin(tempdir, 'cache')
+    os.mkdir(cache_dir)
+    for env in [{}, {'HDIST_JAIL_CACHE_DIR': cache_dir}, {'HDIST_JAIL_CACHE_DIR': cache_dir}]:
+        env['HDIST_JAIL_WHITELIST'] = layers
+        log, out = run_int_checks(tempdir, '', checks, jail_mode='hide', extra_env=env)
+        eq_([1, 1, 0, 1, 0, 0], out)
+        eq_(['%s/work/%s// open' % (tempdir, x) for x in ['pkg/c', 'step/e', 'other']], log)
+    # the merge of all layers and of the base layers
+    eq_(2, len(os.listdir(cache_dir)))
+    # another step reuses the cached base
+    step = write_layer('step.txt', ['step/e'])
+    env['HDIST_JAIL_WHITELIST'] = layers
+    log, out = run_int_checks(tempdir, '', checks, jail_mode='hide', extra_env=env)
+    eq_([1, 1, 0, 0, 1, 0], out)
+    eq_(3, len(os.listdir(cache_dir)))
+
+@fixture()
+def test_cwd_tracking(tempdir):
+    # relative paths must be resolved against the current directory
+    # also after chdir()/fchdir() and in forked children
+    mock_files(tempdir, ['a/okfile', 'a/hiddenfile', 'b/okfile'])
+    preamble = dedent('''
+        int status, dirfd = open(".", O_RDONLY);
+        pid_t pid;
+        ''')
+    checks = ['chdir("a") == 0',
+              'open("okfile", O_RDONLY) != -1',
+              'open("hiddenfile", O_RDONLY) != -1',
+              'chdir("../b") == 0',
+              'open("okfile", O_RDONLY) != -1',
+              'fchdir(dirfd) == 0',
+              'open("a/okfile", O_RDONLY) != -1',
+              '((pid = fork()) == 0) ? (chdir("b"), _exit(open("okfile", O_RDONLY) == -1), 0) : 0',
+              '(waitpid(pid, &status, 0), WEXITSTATUS(status))',
+              'open("b/okfile", O_RDONLY) != -1',
+              ]
+    whitelist = ['a/okfile', 'b/okfile', pjoin(tempdir, 'work')]
+    for env in [{}, {'HDIST_JAIL_CWD_CACHE': '0'}]:
+        log, out = run_int_checks(tempdir, preamble, checks, jail_mode='hide',
+                                  whitelist=whitelist, extra_env=env)
+        eq_([1, 1, 0, 1, 1, 1, 1, 0, 0, 1], out)
+        eq_(['%s/work/a/hiddenfile// open' % tempdir], log)
+
+@fixture()
+def test_no_allocation(tempdir):
+    # the test program interposes the allocator and counts calls made
+    # while the jail handles hooked calls
+    mock_files(tempdir, ['okfile', 'subdir/foo'])
+    toplevel = '''
+        static long n_allocs = 0;
+        extern void *__libc_malloc(size_t n);
+        extern void *__libc_calloc(size_t n, size_t m);
+        extern void *__libc_realloc(void *p, size_t n);
+        void *malloc(size_t n) { n_allocs++; return __libc_malloc(n); }
+        void *calloc(size_t n, size_t m) { n_allocs++; return __libc_calloc(n, m); }
+        void *realloc(void *p, size_t n) { n_allocs++; return __libc_realloc(p, n); }
+        '''
+    preamble = dedent('''
+        long before;
+        int i, fd;
+        before = n_allocs;
+        for (i = 0; i != 100; ++i) {
+            if ((fd = open("okfile", O_RDONLY)) != -1) close(fd);
+            if ((fd = open("../work/./subdir/foo", O_RDONLY)) != -1) close(fd);
+            if ((fd = open("hidden", O_RDONLY)) != -1) close(fd);
+            access("/nonexisting/../hidden", R_OK);
+        }
+        ''')
+    for jail_mode in ['off', 'hide']:
+        log, out = run_int_checks(tempdir, preamble, ['n_allocs - before'],
+                                  jail_mode=jail_mode,
+                                  whitelist=['okfile', 'subdir/**'],
+                                  toplevel_code=toplevel)
+        eq_([0], out)
+        eq_(200, len(log))
+
+@fixture()
+def test_verdict_cache(tempdir):
+    # the same raw path must get a fresh verdict after the working
+    # directory changed
+    mock_files(tempdir, ['a/okfile', 'b/okfile'])
+    checks = ['open("okfile", O_RDONLY) != -1',
+              'open("okfile", O_RDONLY) != -1',
+              'chdir("../b") == 0',
+              'open("okfile", O_RDONLY) != -1',
+              'open("okfile", O_RDONLY) != -1',
+              'chdir("../a") == 0',
+              'open("okfile", O_RDONLY) != -1',
+              'open("%s/work/b/okfile", O_RDONLY) != -1' % tempdir,
+              'open("%s/work/b/okfile", O_RDONLY) != -1' % tempdir,
+              ]
+    for env in [{}, {'HDIST_JAIL_VERDICT_CACHE': '0'}]:
+        log, out = run_int_checks(tempdir, 'chdir("a");', checks, jail_mode='hide',
+                                  whitelist=['a/okfile'], extra_env=env)
+        eq_([1, 1, 1, 0, 0, 1, 1, 0, 0], out)
+        eq_(['%s/work/b/okfile// open' % tempdir] * 4, log)
+
+@fixture()
+def test_dir_cache(tempdir):
+    # files in the same directory share one cached walk of the directory;
+    # each must still get its own verdict
+    mock_files(tempdir, ['big/f%d' % i for i in range(20)] +
+                        ['lib/x/a', 'lib/y', 'inc/a.h', 'inc/a.c', 'top'])
+    checks = (['open("big/f%d", O_RDONLY) != -1' % i for i in range(20)] +
+              ['open("lib/x/a", O_RDONLY) != -1',
+               'open("lib", O_RDONLY) != -1',
+               'open("lib/y", O_RDONLY) != -1',
+               'open("inc/a.h", O_RDONLY) != -1',
+               'open("inc/a.c", O_RDONLY) != -1',
+               'open("top", O_RDONLY) != -1'])
+    whitelist = ['big/f3', 'big/f1[0-9]', 'lib/**', 'inc/*.h', 'top']
+    expected = [0, 0, 0, 1, 0, 0, 0, 0, 0, 0] + [1] * 10 + [1, 0, 1, 1, 0, 1]
+    for env in [{'HDIST_JAIL_VERDICT_CACHE': '0'},
+                {'HDIST_JAIL_VERDICT_CACHE': '0', 'HDIST_JAIL_DIR_CACHE': '0'}]:
+        log, out = run_int_checks(tempdir, '', checks, jail_mode='hide',
+                                  whitelist=whitelist, extra_env=env)
+        eq_(expected, out)
+        eq_(11, len(log))
+
+@fixture()
+def test_log_buffer(tempdir):
+    # buffered entries must survive fork, exec, _exit and abort, and
+    # must not be duplicated in children
+    code = dedent('''
+        int status, i;
+        pid_t pid;
+        char *args[] = {"/bin/true", NULL};
+        open("parent1", O_RDONLY);
+        if ((pid = fork()) == 0) {
+            open("child_exit", O_RDONLY);
+            _exit(0);
+        }
+        waitpid(pid, &status, 0);
+        if ((pid = fork()) == 0) {
+            open("child_abort", O_RDONLY);
+            abort();
+        }
+        waitpid(pid, &status, 0);
+        if ((pid = fork()) == 0) {
+            open("child_exec", O_RDONLY);
+            execv("/bin/true", args);
+            _exit(1);
+        }
+        waitpid(pid, &status, 0);
+        for (i = 0; i != 1000; ++i) open("parent2", O_RDONLY);
+        ''')
+    whitelist = ['/bin/true']
+    for buffer_size in ['64k', '1']:
+        log, out = run_in_jail(tempdir, code, whitelist=whitelist, check_pid=False,
+                               extra_env={'HDIST_JAIL_LOG_BUFFER': buffer_size})
+        log = [x[len(tempdir + '/work/'):] for x in log]
+        eq_(['child_abort// open', 'child_exec// open', 'child_exit// open',
+             'parent1// open'] + ['parent2// open'] * 1000,
+            sorted(log))
+
+@fixture()
+def test_threaded_logging(tempdir):
+    # hammer open() from several threads and check that every log line
+    # is intact
+    n_threads, n_calls = 8, 2000
+    toplevel = '''
+        #include <pthread.h>
+        #include <string.h>
+
+        static void *worker(void *arg) {
+            char path[100];
+            int i;
+            for (i = 0; i != %d; ++i) {
+                sprintf(path, "thread%%ld_%%d_%%s", (long)arg, i,
+                        "padding_padding_padding_padding_padding_padding");
+                open(path, O_RDONLY);
+            }
+            return NULL;
+        }
+        ''' % n_calls
+    code = '''
+        pthread_t threads[%d];
+        long i;
+        for (i = 0; i != %d; ++i) pthread_create(&threads[i], NULL, worker, (void*)i);
+        for (i = 0; i != %d; ++i) pthread_join(threads[i], NULL);
+        ''' % (n_threads, n_threads, n_threads)
+    expected = sorted(
+        '%s/work/thread%d_%d_%s// open' % (tempdir, t, i, 'padding_' * 5 + 'padding')
+        for t in range(n_threads) for i in range(n_calls))
+    for env in [{}, {'HDIST_JAIL_LOG_BUFFER': '4k'}, {'HDIST_JAIL_LOG_BUFFER': '64k'}]:
+        log, out = run_in_jail(tempdir, code, extra_env=env, toplevel_code=toplevel)
+        eq_(expected, sorted(log))
+    log, out = run_in_jail(tempdir, code, toplevel_code=toplevel, collect=True)
+    eq_(expected, sorted(log))
+
+@fixture()
+def test_log_ring(tempdir):
+    # records from forked children, and long paths spanning several
+    # slots, go through the ring intact
+    long_name = 'x' * 1000
+    code = dedent('''
+        int status;
+        pid_t pid;
+        open("parent", O_RDONLY);
+        if ((pid = fork()) == 0) {
+            open("child", O_RDONLY);
+            open("%s", O_RDONLY);
+            _exit(0);
+        }
+        waitpid(pid, &status, 0);
+        ''' % long_name)
+    log, out = run_in_jail(tempdir, code, collect=True)
+    log = [x[len(tempdir + '/work/'):] for x in log]
+    eq_(sorted(['parent// open', 'child// open', long_name + '// open']), sorted(log))
+
+@fixture()
+def test_log_ring_dead_producer(tempdir):
+    # a process killed after reserving a slot does not block the ring:
+    # the collector abandons its record once the tail is stuck
+    code = dedent('''
+        int status, i;
+        pid_t pid;
+        if ((pid = fork()) == 0) {
+            const char *ring = getenv("HDIST_JAIL_LOG_RING");
+            int fd = atoi(strchr(ring, ':') + 1);
+            struct stat st;
+            logring_header_t *h;
+            fstat(fd, &st);
+            h = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            __atomic_fetch_add(&h->head, 1, __ATOMIC_RELAXED);
+            kill(getpid(), SIGKILL);
+        }
+        waitpid(pid, &status, 0);
+        for (i = 0; i != 200; ++i) open("file", O_RDONLY);
+        ''')
+    toplevel = '#include <sys/mman.h>\n#include "%s"\n' % LOGRING_H
+    log, out = run_in_jail(tempdir, code, collect=True, toplevel_code=toplevel)
+    eq_(['%s/work/file// open' % tempdir] * 200, log)
+    assert not os.path.exists(pjoin(tempdir, 'log.overflow'))
+
+@fixture()
+def test_log_dedup(tempdir):
+    code = dedent('''
+        int status, i;
+        pid_t pid;
+        for (i = 0; i != 100; ++i) open("parent", O_RDONLY);
+        fopen("parent", "r");
+        if ((pid = fork()) == 0) {
+            for (i = 0; i != 100; ++i) open("parent", O_RDONLY);
+            open("child", O_RDONLY);
+            _exit(0);
+        }
+        waitpid(pid, &status, 0);
+        ''')
+    for mode, n_parent in [('process', 2), ('tree', 1)]:
+        log, out = run_in_jail(tempdir, code, check_pid=False,
+                               extra_env={'HDIST_JAIL_LOG_DEDUP': mode})
+        log = [x[len(tempdir + '/work/'):] for x in log]
+        eq_(['child// open', 'parent// fopen'] + ['parent// open'] * n_parent,
+            sorted(log))
+
+@fixture()
+def test_log_dedup_set_lost(tempdir):
+    # a process that can not map the inherited set any more (its fd was
+    # closed and its creator has exited) still runs, and still logs
+    mock_files(tempdir, ['child'])
+    code = dedent('''
+        pid_t parent = getpid();
+        open("parent", O_RDONLY);
+        if (fork() == 0) {
+            const char *spec = getenv("HDIST_JAIL_LOG_DEDUP_SET");
+            close(atoi(strchr(spec, ':') + 1));
+            while (getppid() == parent) usleep(1000);
+            execl("/bin/cat", "cat", "child", NULL);
+            _exit(1);
+        }
+        ''')
+    log, out = run_in_jail(tempdir, code, check_pid=False, toplevel_code='#include <string.h>',
+                           extra_env={'HDIST_JAIL_LOG_DEDUP': 'tree'})
+    eq_(['contents'], out)
+    eq_(['child', 'parent'], sorted(x[len(tempdir + '/work/'):].split('//')[0]
+                                    for x in log if x.startswith(tempdir + '/work/')))
+
+@fixture()
+def test_binary_log(tempdir):
+    long_name = 'x' * 1000
+    code = dedent('''
+        int status;
+        pid_t pid;
+        open("parent", O_RDONLY);
+        access("parent", R_OK);
+        if ((pid = fork()) == 0) {
+            open("child", O_RDONLY);
+            open("%s", O_RDONLY);
+            _exit(0);
+        }
+        waitpid(pid, &status, 0);
+        ''' % long_name)
+    configs = [dict(), dict(extra_env={'HDIST_JAIL_LOG_BUFFER': '64k',
+                                       'HDIST_JAIL_LOG_TIMESTAMPS': '1'}),
+               dict(collect=True)]
+    for kw in configs:
+        log, out = run_in_jail(tempdir, code, binary=True, check_pid=False, **kw)
+        log = [x[len(tempdir + '/work/'):] for x in log]
+        eq_(['child// open', 'parent// access', 'parent// open', long_name + '// open'],
+            sorted(log))
+
+@fixture()
+def test_binary_log_definitions(tempdir):
+    # threads using an action for the first time at once never get an
+    # entry into the log ahead of the action's definition
+    toplevel = '''
+        #include <pthread.h>
+        #include <string.h>
+
+        static pthread_barrier_t barrier;
+
+        static void *worker(void *arg) {
+            struct stat s;
+            pthread_barrier_wait(&barrier);
+            switch ((long)arg) {
+            case 0: open("missing", O_RDONLY); break;
+            case 1: stat("missing", &s); break;
+            case 2: lstat("missing", &s); break;
+            case 3: access("missing", R_OK); break;
+            }
+            return NULL;
+        }
+        '''
+    code = '''
+        int status, k;
+        for (k = 0; k != 50; ++k) {
+            if (fork() == 0) {
+                pthread_t threads[4];
+                long i;
+                pthread_barrier_init(&barrier, NULL, 4);
+                for (i = 0; i != 4; ++i) pthread_create(&threads[i], NULL, worker, (void*)i);
+                for (i = 0; i != 4; ++i) pthread_join(threads[i], NULL);
+                _exit(0);
+            }
+            wait(&status);
+        }
+        '''
+    log, out = run_in_jail(tempdir, code, binary=True, check_pid=False, toplevel_code=toplevel)
+    eq_(sorted(['missing// %s' % a for a in ['access', 'lstat', 'open', 'stat']] * 50),
+        sorted(x[len(tempdir + '/work/'):] for x in log))
+
+@fixture()
+def test_execvp_search(tempdir):
+    work = pjoin(tempdir, 'work')
+    for d in ['bin1', 'bin2']:
+        os.mkdir(pjoin(work, d))
+        compile(pjoin(work, d, 'tool'), 'printf("%s\\n");' % d)
+    script = pjoin(work, 'bin1', 'script')
+    with file(script, 'w') as f:
+        f.write('echo script\n')
+    os.chmod(script, 0755)
+    toplevel = r'''
+        static void run(const char *cmd) {
+            pid_t pid = fork();
+            int status;
+            if (pid == 0) {
+                char *args[] = {(char*)cmd, NULL};
+                execvp(cmd, args);
+                printf("%s: %d\n", cmd, errno);
+                fflush(stdout);
+                _exit(1);
+            }
+            waitpid(pid, &status, 0);
+        }
+    '''
+    # a command created after a failed search is found
+    code = r'''
+        run("tool");
+        run("script");
+        run("newtool");
+        link("bin2/tool", "bin1/newtool");
+        run("newtool");
+    '''
+    env = {'PATH': '%s/bin1:%s/bin2' % (work, work)}
+    whitelist = ['bin2/**', 'bin1/script', 'bin1/newtool', '/bin/sh']
+    # bin1/tool is hidden, so bin2/tool is found
+    log, out = run_in_jail(tempdir, code, jail_mode='hide', whitelist=whitelist,
+                           extra_env=env, toplevel_code=toplevel, check_pid=False)
+    eq_(['bin2', 'script', 'newtool: %d' % errno.ENOENT, 'bin2'], out)
+    eq_(['%s/bin1/tool// execvp' % work], [x for x in log if 'bin1/tool' in x])
+    os.unlink(pjoin(work, 'bin1', 'newtool'))
+    log, out = run_in_jail(tempdir, code, whitelist=whitelist,
+                           extra_env=env, toplevel_code=toplevel, check_pid=False)
+    eq_(['bin1', 'script', 'newtool: %d' % errno.ENOENT, 'bin2'], out)
+    eq_(['%s/bin1/tool// execvp' % work], [x for x in log if 'bin1/tool' in x])
+
+@fixture()
+def test_at_funcs(tempdir):
+    # paths relative to directory fds are resolved through the fd table,
+    # which has directories opened with or without O_DIRECTORY, by the
+    # path they were opened with
+    mock_files(tempdir, ['okfile', 'hidden', 'subdir/foo', 'subdir/hidden', 'other/hidden'])
+    os.symlink('subdir', pjoin(tempdir, 'work', 'link'))
+    preamble = dedent('''
+        struct stat s;
+        DIR *dir = opendir("subdir");
+        int work = open(".", O_RDONLY | O_DIRECTORY);
+        int plain = open("subdir", O_RDONLY);
+        int linked = open("link", O_RDONLY);
+        int sub, other;
+        close(open("other", O_RDONLY | O_DIRECTORY));
+        other = open("other", O_RDONLY | O_DIRECTORY);
+        sub = dup(dirfd(dir));
+        ''')
+    checks = [('openat(work, "okfile", O_RDONLY) != -1', None),
+              ('openat(work, "hidden", O_RDONLY) == -1', 'hidden// openat'),
+              ('fstatat(dirfd(dir), "foo", &s, 0) == 0', None),
+              ('fstatat(dirfd(dir), "hidden", &s, 0) == -1', 'subdir/hidden// fstatat'),
+              ('faccessat(sub, "../hidden", R_OK, 0) == -1', 'hidden// faccessat'),
+              ('faccessat(plain, "hidden", R_OK, 0) == -1', 'subdir/hidden// faccessat'),
+              ('faccessat(linked, "foo", R_OK, 0) == -1', 'link/foo// faccessat'),
+              ('openat(other, "hidden", O_RDONLY) == -1', 'other/hidden// openat'),
+              ('fstatat(work, "", &s, AT_EMPTY_PATH) == 0', None),
+              ('stat("hidden", &s) == -1', 'hidden// stat'),
+              ('lstat("subdir/foo", &s) == 0', None)]
+    log, out = run_int_checks(tempdir, preamble, [c for c, _ in checks], jail_mode='hide',
+                              whitelist=[pjoin(tempdir, 'work'), 'okfile', 'subdir',
+                                         'subdir/foo', 'other', 'link'])
+    eq_([1] * len(checks), out)
+    log = [x[len(tempdir + '/work/'):] for x in log]
+    eq_([l for _, l in checks if l], log)
+
+@fixture()
+def test_inherited_whitelist(tempdir):
+    # exec-ed children map the parent's parsed whitelist through the memfd
+    # in HDIST_JAIL_WHITELIST_FD, so they keep working after the whitelist
+    # file is gone; also when exec-ing with an explicit environment
+    mock_files(tempdir, ['okfile', 'hidden'])
+    code = dedent("""
+        int status;
+        pid_t pid;
+        char *args[] = {argv[0], "child", NULL};
+        char *envp[] = {NULL, NULL, NULL, NULL};
+        if (argc > 1) {
+            printf("%d\\n", open("okfile", O_RDONLY) != -1);
+            open("hidden", O_RDONLY);
+            return 0;
+        }
+        unlink(getenv("HDIST_JAIL_WHITELIST"));
+        if ((pid = fork()) == 0) {
+            execv(argv[0], args);
+            _exit(1);
+        }
+        waitpid(pid, &status, 0);
+        asprintf(&envp[0], "LD_PRELOAD=%s", getenv("LD_PRELOAD"));
+        asprintf(&envp[1], "HDIST_JAIL_WHITELIST=%s", getenv("HDIST_JAIL_WHITELIST"));
+        asprintf(&envp[2], "HDIST_JAIL_LOG=%s", getenv("HDIST_JAIL_LOG"));
+        if ((pid = fork()) == 0) {
+            execve(argv[0], args, envp);
+            _exit(1);
+        }
+        waitpid(pid, &status, 0);
+        """)
+    log, out = run_in_jail(tempdir, code, jail_mode='hide', check_pid=False,
+                           whitelist=['okfile', pjoin(tempdir, 'test')])
+    eq_(['1', '1'], out)
+    log = [x[len(tempdir + '/work/'):] for x in log]
+    eq_(['hidden// open'] * 2, log)
+
+@fixture()
+def test_resolved_links(tempdir):
+    # the physical paths behind whitelisted symlinks are added to the
+    # whitelist when resolved, and passed on to exec-ed children
+    work = pjoin(tempdir, 'work')
+    mock_files(tempdir, ['phys/target', 'phys/dir/file', 'wl/file'])
+    os.symlink('../phys/target', pjoin(work, 'wl', 'link'))
+    os.symlink(pjoin(work, 'phys', 'dir'), pjoin(work, 'wl', 'dirlink'))
+    os.symlink('target', pjoin(work, 'phys', 'link'))
+    code = dedent("""
+        struct stat s;
+        char buf[PATH_MAX];
+        char *args[] = {argv[0], "child", NULL};
+        int status;
+        pid_t pid;
+        if (argc > 1) {
+            printf("%d\\n", stat("phys/target", &s) == 0);
+            printf("%d\\n", open("phys/dir/file", O_RDONLY) != -1);
+            return 0;
+        }
+        printf("%d\\n", stat("phys/target", &s) == -1);
+        printf("%d\\n", readlink("wl/link", buf, sizeof(buf)) == 14);
+        printf("%d\\n", stat("phys/target", &s) == 0);
+        printf("%d\\n", open("phys/dir/file", O_RDONLY) == -1);
+        printf("%d\\n", realpath("wl/dirlink", buf) != NULL);
+        printf("%d\\n", open("phys/dir/file", O_RDONLY) != -1);
+        printf("%d\\n", canonicalize_file_name("wl/file") != NULL);
+        printf("%d\\n", readlink("phys/link", buf, sizeof(buf)) == -1);
+        fflush(stdout);
+        if ((pid = fork()) == 0) {
+            execv(argv[0], args);
+            _exit(1);
+        }
+        waitpid(pid, &status, 0);
+        """)
+    log, out = run_in_jail(tempdir, code, jail_mode='hide', check_pid=False,
+                           whitelist=['wl/**', pjoin(tempdir, 'test')],
+                           toplevel_code='#include <limits.h>')
+    eq_(['1'] * 10, out)
+    log = [x[len(work) + 1:] for x in log]
+    eq_(['phys/target// stat', 'phys/target// readlink-of-blacklisted',
+         'phys/dir/file// open', 'phys/dir// realpath-of-blacklisted',
+         'phys/link// readlink'], log)
+
+@fixture()
+def test_resolved_links_exact(tempdir):
+    # resolving a link into an ancestor of itself, or one of the links in
+    # /proc, adds only the result itself, not everything beneath it
+    work = pjoin(tempdir, 'work')
+    mock_files(tempdir, ['wl/file', 'other/file'])
+    os.symlink('../..', pjoin(work, 'wl', 'up'))
+    code = dedent("""
+        char buf[PATH_MAX], link[64];
+        int fd = open("other", O_RDONLY | O_DIRECTORY);
+        printf("%d\\n", readlink("wl/up", buf, sizeof(buf)) == 5);
+        printf("%d\\n", realpath("/proc/self/cwd", buf) != NULL);
+        sprintf(link, "/proc/self/fd/%d", fd);
+        printf("%d\\n", realpath(link, buf) != NULL);
+        printf("%d\\n", open("other/file", O_RDONLY) == -1);
+        printf("%d\\n", open("wl/file", O_RDONLY) != -1);
+        """)
+    log, out = run_in_jail(tempdir, code, jail_mode='hide', check_pid=False,
+                           whitelist=['wl/**', 'other', '/proc/**'],
+                           toplevel_code='#include <limits.h>')
+    eq_(['1'] * 5, out)
+    log = [x[len(tempdir):] for x in log]
+    eq_(['// readlink-of-blacklisted', '/work// realpath-of-blacklisted',
+         '/work/other/file// open'], log)
+
+@fixture()
+def test_whitelist_fd_vfork(tempdir):
+    # a vfork() child gets the whitelist as exported by its parent, and
+    # leaves the parent's export alone; the memfd is close-on-exec but
+    # for the exec that passes it on
+    work = pjoin(tempdir, 'work')
+    mock_files(tempdir, ['phys/target', 'wl/file'])
+    os.symlink('../phys/target', pjoin(work, 'wl', 'link'))
+    toplevel = dedent("""
+        #include <limits.h>
+        static int whitelist_fd(void) {
+            int fd = -1;
+            sscanf(getenv("HDIST_JAIL_WHITELIST_FD"), "%d:", &fd);
+            return fd;
+        }
+        """)
+    code = dedent("""
+        struct stat s;
+        char buf[PATH_MAX];
+        char *args[] = {argv[0], "child", NULL};
+        int status;
+        pid_t pid;
+        if (argc > 1) {
+            printf("%d\\n", stat("phys/target", &s) == 0);
+            printf("%d\\n", (fcntl(whitelist_fd(), F_GETFD) & FD_CLOEXEC) != 0);
+            return 0;
+        }
+        printf("%d\\n", readlink("wl/link", buf, sizeof(buf)) == 14);
+        fflush(stdout);
+        if ((pid = vfork()) == 0) {
+            execv(argv[0], args);
+            _exit(1);
+        }
+        waitpid(pid, &status, 0);
+        printf("%d\\n", fcntl(whitelist_fd(), F_GET_SEALS) != -1);
+        printf("%d\\n", (fcntl(whitelist_fd(), F_GETFD) & FD_CLOEXEC) != 0);
+        """)
+    log, out = run_in_jail(tempdir, code, jail_mode='hide', check_pid=False,
+                           whitelist=['wl/**', pjoin(tempdir, 'test')],
+                           toplevel_code=toplevel)
+    eq_(['1'] * 5, out)
+
+@fixture()
+def test_fork_bomb(tempdir):
+    # every log line carries the pid of the process that made the access,
+    # however it was created, and none is lost or written twice
+    toplevel = dedent("""
+        #include <sched.h>
+        #include <signal.h>
+        static char stacks[2][65536];
+        static void touch(const char *what) {
+            char path[64];
+            snprintf(path, sizeof(path), "hidden-%s-%d", what, (int)getpid());
+            open(path, O_RDONLY);
+        }
+        static int clone_child(void *arg) {
+            touch(arg);
+            return 0;
+        }
+        """)
+    code = dedent("""
+        int i, status;
+        pid_t pid;
+        touch("main");
+        for (i = 0; i != 5; ++i) {
+            if (fork() == 0) touch("fork");
+        }
+        if ((pid = vfork()) == 0) {
+            touch("vfork");
+            _exit(0);
+        }
+        waitpid(pid, &status, 0);
+        pid = clone(clone_child, stacks[0] + sizeof(stacks[0]), SIGCHLD, "clone");
+        waitpid(pid, &status, 0);
+        pid = clone(clone_child, stacks[1] + sizeof(stacks[1]),
+                    CLONE_VM | CLONE_VFORK | SIGCHLD, "clonevm");
+        waitpid(pid, &status, 0);
+        touch("after");
+        while (wait(&status) > 0);
+        """)
+    for env in [{}, {'HDIST_JAIL_LOG_BUFFER': '64k'}]:
+        log, out = run_in_jail(tempdir, code, jail_mode='hide', whitelist=[],
+                               toplevel_code=toplevel, extra_env=env,
+                               check_pid=False, with_pids=True)
+        eq_(1 + 31 + 4 * 32, len(log))
+        for pid, line in log:
+            eq_(pid, line.split('-')[-1].split('/')[0])
+        kinds = [line.split('-')[-2] for pid, line in log]
+        eq_([1, 31, 32, 32, 32, 32], [kinds.count(k) for k in
+                                      ['main', 'fork', 'vfork', 'clone', 'clonevm', 'after']])
+        eq_(len(log), len(set(line for pid, line in log)))
+
+@fixture()
+def test_clone_vm_child_ends(tempdir):
+    # the cwd cache is bypassed while a child sharing our memory runs, and
+    # used again once it has exited or exec-ed; a directory change behind
+    # the cache's back shows which
+    toplevel = dedent("""
+        #include <sched.h>
+        #include <signal.h>
+        #include <sys/syscall.h>
+        static char stacks[3][65536];
+        static int fds[2];
+        static int waiting_child(void *arg) {
+            char c;
+            read(fds[0], &c, 1);
+            return 0;
+        }
+        static int exiting_child(void *arg) {
+            return 0;
+        }
+        static int exec_child(void *arg) {
+            execl("/bin/true", "true", (char *)NULL);
+            return 1;
+        }
+        static void behind_our_back(const char *before, const char *after) {
+            open(before, O_RDONLY);
+            syscall(SYS_chdir, "sub");
+            open(after, O_RDONLY);
+            syscall(SYS_chdir, "..");
+        }
+        """)
+    code = dedent("""
+        int status;
+        pid_t pid;
+        mkdir("sub", 0700);
+        pipe(fds);
+        pid = clone(waiting_child, stacks[0] + sizeof(stacks[0]), CLONE_VM | SIGCHLD, NULL);
+        behind_our_back("a", "b");
+        write(fds[1], "x", 1);
+        waitpid(pid, &status, 0);
+        pid = clone(exiting_child, stacks[1] + sizeof(stacks[1]), CLONE_VM | SIGCHLD, NULL);
+        waitpid(pid, &status, 0);
+        pid = clone(exec_child, stacks[2] + sizeof(stacks[2]), CLONE_VM | SIGCHLD, NULL);
+        waitpid(pid, &status, 0);
+        behind_our_back("c", "d");
+        """)
+    log, out = run_in_jail(tempdir, code, toplevel_code=toplevel, check_pid=False)
+    work = pjoin(tempdir, 'work')
+    assert pjoin(work, 'sub', 'b') + '// open' in log
+    assert pjoin(work, 'd') + '// open' in log
+
+@fixture()
+def test_stats(tempdir):
+    # counts from all threads and from both sides of a fork are recorded
+    mock_files(tempdir, ['okfile', 'hidden'])
+    toplevel = dedent("""
+        #include <pthread.h>
+        void *thread(void *arg) {
+            open("hidden", O_RDONLY);
+            return NULL;
+        }
+        """)
+    code = dedent("""
+        pthread_t t;
+        int status;
+        pid_t pid;
+        struct stat s;
+        open("okfile", O_RDONLY);
+        pthread_create(&t, NULL, thread, NULL);
+        pthread_join(t, NULL);
+        if ((pid = fork()) == 0) {
+            stat("hidden", &s);
+            return 0;
+        }
+        waitpid(pid, &status, 0);
+        """)
+    stats_filename = pjoin(tempdir, 'stats')
+    run_in_jail(tempdir, code, jail_mode='hide', whitelist=['okfile'], should_log=False,
+                toplevel_code=toplevel, extra_env={'HDIST_JAIL_STATS': stats_filename},
+                jail_so=STATS_JAIL_SO)
+    with file(stats_filename) as f:
+        records = [line.split() for line in f]
+    eq_(['calls=2', 'allowed=1', 'denied=1'], [r[2:5] for r in records if r[1] == 'open'][0])
+    eq_(['calls=1', 'allowed=0', 'denied=1'], [r[2:5] for r in records if r[1] == 'stat'][0])
+    eq_(2, len(set(r[0] for r in records)))
+    out = subprocess.check_output([STATS_TOOL, stats_filename])
+    assert 'processes: 2\n' in out
+    assert 'checked: 3 (allowed 1, 33.3%)\n' in out
+
+@fixture()
+def test_record_replay(tempdir):
+    # every checked path is recorded as given, with the working directory,
+    # and the trace is checked again in-process by hdistjail-replay
+    mock_files(tempdir, ['okfile', 'hidden', 'subdir/foo'])
+    work = pjoin(tempdir, 'work')
+    code = dedent("""
+        struct stat s;
+        int status, dir;
+        open("okfile", O_RDONLY);
+        stat("hidden", &s);
+        chdir("subdir");
+        stat("foo", &s);
+        if (fork() == 0) {
+            access("../hidden", R_OK);
+            _exit(0);
+        }
+        wait(&status);
+        dir = open(".", O_RDONLY | O_DIRECTORY);
+        openat(dir, "foo", O_RDONLY);
+        """)
+    trace = pjoin(tempdir, 'trace')
+    run_in_jail(tempdir, code, should_log=False, extra_env={'HDIST_JAIL_RECORD': trace},
+                jail_so=STATS_JAIL_SO)
+    decoded = subprocess.check_output([LOGSTAT_TOOL, '-d', trace])
+    eq_(['okfile// open', 'hidden// stat', 'foo// stat', '../hidden// access',
+         '.// open', '%s/subdir/foo// openat' % work],
+        [line.split(' ', 1)[1] for line in decoded.splitlines()])
+    whitelist = pjoin(tempdir, 'whitelist.txt')
+    with file(whitelist, 'w') as f:
+        f.write('%s/okfile\n%s/subdir/foo\n' % (work, work))
+    env = {'HDIST_JAIL_WHITELIST': whitelist, 'HDIST_JAIL_MODE': 'hide'}
+    for args, n in [([], 1), (['-j', '2', '-n', '2'], 4)]:
+        out = subprocess.check_output([REPLAY_TOOL, '-p', JAIL_SO] + args + [trace], env=env)
+        result = json.loads(out)
+        eq_([6 * n, 3 * n, 0, 3 * n],
+            [result[k] for k in ['calls', 'whitelisted', 'denied', 'hidden']])
+
+@fixture()
+def test_learn_fold(tempdir):
+    # in learn mode whitelisted paths are logged too, once per process
+    # tree, and hdistjail-fold folds the log into a whitelist
+    lib = ['lib/%s' % x for x in 'abcde']
+    mock_files(tempdir, ['okfile'] + lib + ['other/%s' % x for x in 'vwxyz'])
+    work = pjoin(tempdir, 'work')
+    code = dedent("""
+        struct stat s;
+        int status;
+        open("okfile", O_RDONLY);
+        open("other/x", O_RDONLY);
+        if (fork() == 0) {
+            open("okfile", O_RDONLY);
+            open("lib/a", O_RDONLY);
+            open("lib/b", O_RDONLY);
+            stat("lib/c", &s);
+            open("lib/d", O_RDONLY);
+            _exit(0);
+        }
+        wait(&status);
+        """)
+    log = pjoin(tempdir, 'learn.log')
+    run_in_jail(tempdir, code, jail_mode='learn', whitelist=['okfile'], should_log=False,
+                extra_env={'HDIST_JAIL_LOG': log})
+    with file(log) as f:
+        logged = sorted(line[:-1].split(' ', 1)[1] for line in f)
+    eq_(['%s/%s// %s' % (work, x, action) for x, action in
+         [('lib/a', 'open'), ('lib/b', 'open'), ('lib/c', 'stat'), ('lib/d', 'open'),
+          ('okfile', 'open'), ('other/x', 'open')]], logged)
+    for args, expected in [([], ['lib/**', 'okfile', 'other/x']),
+                           (['-r', '90'], lib[:4] + ['okfile', 'other/x']),
+                           (['-m', '5'], lib[:4] + ['okfile', 'other/x'])]:
+        whitelist = subprocess.check_output([FOLD_TOOL] + args + [log])
+        eq_(['%s/%s' % (work, x) for x in expected], whitelist.splitlines())
+
+@fixture()
+def test_variants(tempdir):
+    # the specialized builds behave like the default one for what they
+    # support, and refuse to run when asked for anything else
+    mock_files(tempdir, ['okfile', 'hidden'])
+    checks = ['open("okfile", O_RDONLY) != -1', 'open("hidden", O_RDONLY) == -1']
+    log, out = run_int_checks(tempdir, '', checks, jail_mode='hide', whitelist=['okfile'],
+                              should_log=False, jail_so=HIDE_JAIL_SO)
+    eq_([1, 1], out)
+    log, out = run_int_checks(tempdir, '', checks[:1], whitelist=['okfile'],
+                              jail_so=LOG_JAIL_SO)
+    eq_([1], out)
+    eq_([], log)
+    log, out = run_int_checks(tempdir, 'open("hidden", O_RDONLY);', [], whitelist=['okfile'],
+                              jail_so=LOG_JAIL_SO)
+    eq_(['%s/work/hidden// open' % tempdir], log)
+    for jail_so, kw in [(HIDE_JAIL_SO, dict()),
+                        (LOG_JAIL_SO, dict(jail_mode='hide', should_log=False)),
+                        (JAIL_SO, dict(extra_env={'HDIST_JAIL_STATS': pjoin(tempdir, 'stats')}))]:
+        try:
+            run_in_jail(tempdir, '', jail_so=jail_so, **kw)
+        except subprocess.CalledProcessError as e:
+            eq_(30, e.returncode)
+        else:
+            assert False
+
+def landlock_available():
+    # landlock_create_ruleset(NULL, 0, LANDLOCK_CREATE_RULESET_VERSION)
+    if os.uname()[4] != 'x86_64':
+        return False
+    return ctypes.CDLL(None, use_errno=True).syscall(444, None, 0, 1) >= 1
+
+@fixture()
+def test_landlock(tempdir):
+    if not landlock_available():
+        raise SkipTest('Landlock is not available')
+    mock_files(tempdir, ['okfile', 'hidden', 'subdir/foo'])
+    preamble = '#include <sys/syscall.h>'
+    checks = ['syscall(SYS_openat, AT_FDCWD, "okfile", O_RDONLY) != -1',
+              'syscall(SYS_openat, AT_FDCWD, "subdir/foo", O_RDONLY) != -1',
+              'syscall(SYS_openat, AT_FDCWD, "hidden", O_RDONLY) == -1 && errno == EACCES',
+              'open("hidden", O_RDONLY) == -1',
+              'errno']
+    env = {'HDIST_JAIL_LANDLOCK': '1'}
+    # with logging, the hooks still check everything
+    log, out = run_int_checks(tempdir, '', checks, jail_mode='hide', extra_env=env,
+                              whitelist=['okfile', 'subdir/**'], toplevel_code=preamble)
+    eq_([1, 1, 1, 1, errno.ENOENT], out)
+    eq_(['%s/work/hidden// open' % tempdir], log)
+    # without, read-only opens are left to the kernel
+    log, out = run_int_checks(tempdir, '', checks, jail_mode='hide', extra_env=env,
+                              whitelist=['okfile', 'subdir/**'], toplevel_code=preamble,
+                              should_log=False)
+    eq_([1, 1, 1, 1, errno.EACCES], out)
+
+@fixture()
+def test_landlock_missing_entry(tempdir):
+    # a whitelisted file created after the ruleset was made can be read
+    # through its directory; one whose directory was missing too is left
+    # out, rather than opening up a directory further up
+    if not landlock_available():
+        raise SkipTest('Landlock is not available')
+    mock_files(tempdir, ['sub/hidden', 'other/hidden'])
+    preamble = '#include <sys/syscall.h>'
+    checks = ['open("sub/later", O_CREAT | O_WRONLY, 0600) != -1',
+              'syscall(SYS_openat, AT_FDCWD, "sub/later", O_RDONLY) != -1',
+              'open("sub/later", O_RDONLY) != -1',
+              'open("sub/hidden", O_RDONLY) == -1',
+              'syscall(SYS_mkdirat, AT_FDCWD, "other/gone", 0700) == 0',
+              'syscall(SYS_openat, AT_FDCWD, "other/gone/file", O_CREAT | O_WRONLY, 0600) != -1',
+              'syscall(SYS_openat, AT_FDCWD, "other/gone/file", O_RDONLY) == -1 && errno == EACCES']
+    log, out = run_int_checks(tempdir, '', checks, jail_mode='hide',
+                              extra_env={'HDIST_JAIL_LANDLOCK': '1'},
+                              whitelist=['sub/later', 'other/gone/file'], toplevel_code=preamble,
+                              should_log=False)
+    eq_([1] * len(checks), out)
+
 @fixture()
 def test_log_no_whitelist(tempdir):
     log, out = run_int_checks(